@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <regex.h>
+
+#include "http.h"
+
+//! \file
+//! request header parsing cost: POSIX regex matcher the server used before http.c against http_parse
+//! usage: http_bench [requests file or -] [rounds], file holds raw requests each ending with empty line
+//! build: make -C src bench
+
+static const char* corpus[]=
+{
+  "GET /tiles/14/8802/5373.pbf HTTP/1.1\r\n"
+  "Host: tiles.example.org\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+  "Accept: */*\r\n"
+  "Accept-Language: en-US,en;q=0.5\r\n"
+  "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+  "Origin: https://map.example.org\r\n"
+  "Connection: keep-alive\r\n"
+  "Referer: https://map.example.org/\r\n"
+  "Sec-Fetch-Dest: empty\r\n"
+  "Sec-Fetch-Mode: cors\r\n"
+  "Sec-Fetch-Site: same-site\r\n"
+  "If-None-Match: \"5f1d3a9c0b7e2d41\"\r\n"
+  "\r\n",
+  "GET /k/1/item7.bin HTTP/1.1\r\n"
+  "Host: 127.0.0.1:8080\r\n"
+  "User-Agent: curl/8.5.0\r\n"
+  "Accept: */*\r\n"
+  "\r\n",
+  "HEAD /k/2/item14.bin?v=3 HTTP/1.0\r\n"
+  "Host: 127.0.0.1\r\n"
+  "\r\n",
+  "GET /tiles/3/4/2.pbf HTTP/1.1\r\n"
+  "Host: tiles.example.org\r\n"
+  "Range: bytes=0-1023\r\n"
+  "Connection: close\r\n"
+  "\r\n",
+};
+
+typedef struct req_t
+{
+  char* b;
+  size_t len;
+} req_t;
+
+static regex_t rre1;
+
+//! case insensitive token in [s,e)
+static int hasword(const char* s,const char* e,const char* w)
+{
+  size_t l=strlen(w);
+  for(;s+l<=e;s++)
+    if(!strncasecmp(s,w,l)) return 1;
+  return 0;
+}
+
+//! request end, method, path and persistence as server found them with regex, path length or 0
+static size_t parse_regex(char* b,size_t szin,int* close)
+{
+  regmatch_t match[3]={0,};
+  void* e=memmem(b,szin,"\r\n\r\n",4);
+  if(!e) return 0;
+  size_t rlen=e+4-(void*)b;
+  char save=b[rlen-1];
+  b[rlen-1]=0;
+  size_t klen=0;
+  if(!regexec(&rre1,b,3,match,0))
+  {
+    klen=match[2].rm_eo-match[2].rm_so;
+    const char* le=strstr(b,"\r\n");
+    *close=hasword(b,le,"HTTP/1.0");
+    const char* h=strcasestr(le,"\r\nConnection:");
+    if(h && hasword(h+13,strstr(h+2,"\r\n"),"close")) *close=1;
+  }
+  b[rlen-1]=save;
+  return klen;
+}
+
+static size_t parse_http(char* b,size_t szin,int* close)
+{
+  http_req_t r;
+  size_t rlen=http_end(b,szin,0);
+  if(!rlen || http_parse(b,rlen,0,&r) || r.method==HTTP_OTHER) return 0;
+  *close=r.close;
+  return r.plen;
+}
+
+static double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return t.tv_sec+t.tv_nsec*1e-9;
+}
+
+//! ns per request over rounds passes of corpus, checksum keeps results alive
+static double run(size_t (*f)(char*,size_t,int*),req_t* q,size_t n,size_t rounds,size_t* sum)
+{
+  double t=now();
+  for(size_t i=0;i<rounds;i++)
+    for(size_t j=0;j<n;j++)
+    {
+      int close=0;
+      *sum+=f(q[j].b,q[j].len,&close)+close;
+    }
+  return (now()-t)*1e9/(rounds*n);
+}
+
+static req_t* load(const char* fn,size_t* n)
+{
+  req_t* q=0;
+  *n=0;
+  if(!fn)
+  {
+    size_t k=sizeof(corpus)/sizeof(corpus[0]);
+    q=calloc(k,sizeof(*q));
+    for(;*n<k;(*n)++)
+    {
+      q[*n].len=strlen(corpus[*n]);
+      q[*n].b=strdup(corpus[*n]);
+    }
+    return q;
+  }
+  FILE* f=fopen(fn,"r");
+  if(!f)
+  {
+    perror(fn);
+    exit(1);
+  }
+  char* d=0;
+  size_t sz=0;
+  getdelim(&d,&sz,0,f);
+  fclose(f);
+  size_t len=strlen(d);
+  for(char* p=d;p<d+len;)
+  {
+    char* e=memmem(p,d+len-p,"\r\n\r\n",4);
+    if(!e) break;
+    e+=4;
+    q=realloc(q,(*n+1)*sizeof(*q));
+    q[*n].len=e-p;
+    q[*n].b=strndup(p,e-p);
+    (*n)++;
+    p=e;
+  }
+  free(d);
+  return q;
+}
+
+int main(int ac,char** av)
+{
+  size_t n,sum=0;
+  req_t* q=load(ac>1 && strcmp(av[1],"-") ? av[1] : 0,&n);
+  size_t rounds=ac>2 ? strtoul(av[2],0,10) : 1000000/(n ? n : 1);
+  if(!n || !rounds)
+  {
+    fprintf(stderr,"no requests\n");
+    return 1;
+  }
+  regcomp(&rre1,"^\\(GET\\|HEAD\\)[[:blank:]]\\+\\([^[:blank:]]\\+\\)",REG_NEWLINE|REG_ICASE);
+
+  size_t diff=0;
+  for(size_t j=0;j<n;j++)
+  {
+    int c1=0,c2=0;
+    size_t k1=parse_regex(q[j].b,q[j].len,&c1),k2=parse_http(q[j].b,q[j].len,&c2);
+// only success is compared, regex path keeps query string
+    if(!k1!=!k2 || c1!=c2) diff++;
+  }
+
+  double tr=run(parse_regex,q,n,rounds,&sum);
+  double th=run(parse_http,q,n,rounds,&sum);
+  printf("%zu requests x %zu rounds, %zu disagree\n",n,rounds,diff);
+  printf("regexec     %8.1f ns/request\n",tr);
+  printf("http_parse  %8.1f ns/request  %.1fx\n",th,tr/th);
+  printf("checksum %zu\n",sum);
+  regfree(&rre1);
+  for(size_t j=0;j<n;j++) free(q[j].b);
+  free(q);
+  return 0;
+}
@@ -2,11 +2,17 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#define SYSLOG_NAMES
+#include <syslog.h>
 
 #include <jansson.h>
 
 #include "macros.h"
 #include "cfg.h"
+#include "db.h"
+#include "server.h"
+#include "http.h"
 
 
 
@@ -22,14 +28,23 @@ cfg_build_t* cfg_init_build(const char* json_filename)
   if(CFGB) cfg_build_free(CFGB);
   cfg_build_t* rv=md_new(rv);
 
-  if(json_unpack(j,"{s:s,s:s,s:b}","src",&rv->src,"db",&rv->db,"dedup",&rv->dedup))  $abort("unpack error");
+  const char* index="compact";
+  const char* names="front";
+  rv->tile_index=1;
+  rv->etag=1;
+  if(json_unpack(j,"{s:s,s:s,s:b,s?:i,s?:i,s?:i,s?:s,s?:s,s?:b,s?:b}","src",&rv->src,"db",&rv->db,"dedup",&rv->dedup,"parts",&rv->parts,"threads",&rv->threads,"fingerprint",&rv->fingerprint,
+    "index",&index,"names",&names,"tile_index",&rv->tile_index,"etag",&rv->etag))  $abort("unpack error");
   rv->src=strdup(rv->src);
   rv->db=strdup(rv->db);
-
-/*
-  dedup
-  parts
-*/
+  if(rv->parts<=0) rv->parts=1;
+  if(!strcmp(index,"compact")) rv->index=DB_INDEX_COMPACT;
+  else if(!strcmp(index,"aligned")) rv->index=DB_INDEX_ALIGNED;
+  else if(!strcmp(index,"wide")) rv->index=DB_INDEX_WIDE;
+  else $abort("index must be compact, aligned or wide");
+  if(!strcmp(names,"front")) rv->names=DB_NAMES_FRONT;
+  else if(!strcmp(names,"plain")) rv->names=DB_NAMES_PLAIN;
+  else if(!strcmp(names,"none")) rv->names=DB_NAMES_NONE;
+  else $abort("names must be front, plain or none");
 
 
   json_decref(j);
@@ -38,7 +53,16 @@ cfg_build_t* cfg_init_build(const char* json_filename)
   return rv;
 }
 
-static char* hjoin(json_t* j,const char* fl,int tail)
+static int resident_mode(const char* m)
+{
+  if(!strcmp(m,"none")) return DB_RESIDENT_NONE;
+  if(!strcmp(m,"willneed")) return DB_RESIDENT_WILLNEED;
+  if(!strcmp(m,"lock")) return DB_RESIDENT_LOCK;
+  $abort("resident policy must be none, willneed or lock");
+}
+
+//! Connection is set by server, headers starting with skip are dropped, tail ends the header
+static char* hjoin(json_t* j,const char* fl,const char* skip,const char* tail,int close)
 {
   if(!j || !json_is_array(j)) $abort("headers must be array of strings");
 
@@ -51,9 +75,12 @@ static char* hjoin(json_t* j,const char* fl,int tail)
   {
     json_t* n=json_array_get(j,i);
     if(!json_is_string(n)) $abort("headers must be strings");
-    fprintf(mem,"%s\r\n",json_string_value(n));
+    const char* v=json_string_value(n);
+    if(!strncasecmp(v,"Connection:",11) || (skip && !strncasecmp(v,skip,strlen(skip)))) continue;
+    fprintf(mem,"%s\r\n",v);
   }
-  if(tail) fprintf(mem,"\r\n");
+  if(close) fprintf(mem,"Connection: close\r\n");
+  if(tail) fprintf(mem,"%s",tail);
   fclose(mem);
   return m;
 }
@@ -69,10 +96,86 @@ cfg_server_t* cfg_init_server(const char* json_filename)
 
   json_t* h=0;
   json_t* nf=0;
-  if(json_unpack(j,"{s:s,s:s,s:o,s:o,s:i,s:i,s:i,s:i}","db",&rv->db,"socket",&rv->socket,"headers",&h,"h404",&nf,"threads",&rv->threads,"port",&rv->port,"backlog",&rv->backlog,"inbuffer",&rv->inbuf))  $abort("unpack error");
+  json_t* lg=0;
+  json_t* rs=0;
+  json_t* ht=0;
+  const char* verify="";
+  const char* backend="epoll";
+  const char* steering="none";
+  const char* msock=0;
+  const char* health="/health";
+  const char* handoff=0;
+  int trust=0;
+  int decode=0;
+  int query=0;
+  rv->keepalive=1;
+  rv->drain=30000;
+  rv->grace=30000;
+  if(json_unpack(j,"{s:s,s:s,s:o,s:o,s:i,s:i,s:i,s:i,s?:s,s?:i,s?:b,s?:b,s?:i,s?:s,s?:b,s?:b,s?:s,s?:b,s?:b,s?:i,s?:s,s?:i,s?:s,s?:o,s?:s,s?:i,s?:i,s?:i,s?:o,s?:o}","db",&rv->db,"socket",&rv->socket,"headers",&h,"h404",&nf,"threads",&rv->threads,"port",&rv->port,"backlog",&rv->backlog,"inbuffer",&rv->inbuf,
+    "verify",&verify,"scrub",&rv->scrub,"trust_fingerprint",&trust,"keepalive",&rv->keepalive,"sendfile",&rv->sendfile,"backend",&backend,
+    "reuseport",&rv->reuseport,"pin",&rv->pin,"steering",&steering,
+    "decode",&decode,"keep_query",&query,"timeout",&rv->timeout,
+    "metrics_socket",&msock,"metrics_port",&rv->metrics_port,"health",&health,"log",&lg,
+    "handoff",&handoff,"drain",&rv->drain,"grace",&rv->grace,"io_threads",&rv->io_threads,"resident",&rs,"heat",&ht))  $abort("unpack error");
+  if(rv->timeout<0) rv->timeout=0;
+  if(rv->io_threads<0) rv->io_threads=0;
+  if(rv->grace<0) rv->grace=0;
+
+  if(strstr(verify,"lazy")) rv->dbflags|=DB_VERIFY_LAZY|(rv->io_threads ? DB_VERIFY_DEFER : 0);
+  if(strstr(verify,"full")) rv->dbflags|=DB_VERIFY_FULL;
+  if(trust) rv->dbflags|=DB_TRUST_FINGERPRINT;
+  if(decode) rv->httpflags|=HTTP_DECODE;
+  if(query) rv->httpflags|=HTTP_KEEP_QUERY;
+  if(!strcmp(backend,"epoll")) rv->backend=SERVER_BACKEND_EPOLL;
+  else if(!strcmp(backend,"uring")) rv->backend=SERVER_BACKEND_URING;
+  else $abort("backend must be epoll or uring");
+  if(!strcmp(steering,"none")) rv->steering=SERVER_STEER_NONE;
+  else if(!strcmp(steering,"cpu")) rv->steering=SERVER_STEER_CPU;
+  else if(!strcmp(steering,"bpf")) rv->steering=SERVER_STEER_BPF;
+  else $abort("steering must be none, cpu or bpf");
 
   rv->db=strdup(rv->db);
   rv->socket=strdup(rv->socket);
+  rv->metrics_socket=msock ? strdup(msock) : 0;
+  rv->health=strdup(health);
+  rv->handoff=handoff ? strdup(handoff) : 0;
+
+  const char* facility="daemon";
+  const char* id="0decca";
+  const char* lfile=0;
+  const char* lsock=0;
+  rv->log_sample=1;
+  rv->log_ring=4096;
+  if(lg && json_unpack(lg,"{s?:b,s?:s,s?:s,s?:s,s?:s,s?:i,s?:i}","request",&rv->log_request,"facility",&facility,"id",&id,
+    "file",&lfile,"socket",&lsock,"sample",&rv->log_sample,"ring",&rv->log_ring)) $abort("log unpack error");
+  rv->log_facility=-1;
+  for(CODE* c=facilitynames;c->c_name;c++)
+    if(!strcmp(c->c_name,facility)) rv->log_facility=c->c_val;
+  if(rv->log_facility<0) $abort("unknown syslog facility");
+  rv->log_id=strdup(id);
+  rv->log_file=lfile ? strdup(lfile) : 0;
+  rv->log_socket=lsock ? strdup(lsock) : 0;
+  const char* rindex="none";
+  const char* rnames="none";
+  const char* rdata="lock";
+  const char* rkeys=0;
+  rv->resident_zoom=-1;
+  if(rs && json_unpack(rs,"{s?:s,s?:s,s?:s,s?:i,s?:s}","index",&rindex,"names",&rnames,"data",&rdata,"zoom",&rv->resident_zoom,"keys",&rkeys)) $abort("resident unpack error");
+  rv->resident_index=resident_mode(rindex);
+  rv->resident_names=resident_mode(rnames);
+  rv->resident_data=resident_mode(rdata);
+  rv->resident_keys=rkeys ? strdup(rkeys) : 0;
+
+  const char* hfile=0;
+  rv->heat_interval=60000;
+  rv->heat_sample=16;
+  rv->heat_threads=4;
+  if(ht && json_unpack(ht,"{s:s,s?:i,s?:i,s?:i,s?:b}","file",&hfile,"interval",&rv->heat_interval,"sample",&rv->heat_sample,
+    "threads",&rv->heat_threads,"wait",&rv->heat_wait)) $abort("heat unpack error");
+  if(rv->heat_interval<1000) rv->heat_interval=1000;
+  if(rv->heat_sample<1) rv->heat_sample=1;
+  if(rv->heat_threads<1) rv->heat_threads=1;
+  rv->heat_file=hfile ? strdup(hfile) : 0;
 /*
   size_t l=0;
   char* m=0;
@@ -92,8 +195,27 @@ cfg_server_t* cfg_init_server(const char* json_filename)
   fclose(mem);
   rv->headers=m;
 */
-  rv->headers=hjoin(h,"HTTP/1.1 200 OK",0);
-  rv->h404=hjoin(nf,"HTTP/1.1 404 Not Found",1);
+  rv->headers=hjoin(h,"HTTP/1.1 200 OK",0,0,0);
+  rv->headers_close=hjoin(h,"HTTP/1.1 200 OK",0,0,1);
+  rv->h404=hjoin(nf,"HTTP/1.1 404 Not Found","Content-Length:","Content-Length: 0\r\n\r\n",0);
+  rv->h404_close=hjoin(nf,"HTTP/1.1 404 Not Found","Content-Length:","Content-Length: 0\r\n\r\n",1);
+// 304 keeps caching headers of 200, representation ones are left out
+  rv->h304=hjoin(h,"HTTP/1.1 304 Not Modified","Content-",0,0);
+  rv->h304_close=hjoin(h,"HTTP/1.1 304 Not Modified","Content-",0,1);
+  rv->h206=hjoin(h,"HTTP/1.1 206 Partial Content","Content-Length:",0,0);
+  rv->h206_close=hjoin(h,"HTTP/1.1 206 Partial Content","Content-Length:",0,1);
+  rv->h206m=hjoin(h,"HTTP/1.1 206 Partial Content","Content-",0,0);
+  rv->h206m_close=hjoin(h,"HTTP/1.1 206 Partial Content","Content-",0,1);
+  rv->h416=hjoin(nf,"HTTP/1.1 416 Range Not Satisfiable","Content-Length:",0,0);
+  rv->h416_close=hjoin(nf,"HTTP/1.1 416 Range Not Satisfiable","Content-Length:",0,1);
+  for(size_t i=0;i<json_array_size(h);i++)
+  {
+    const char* v=json_string_value(json_array_get(h,i));
+    if(strncasecmp(v,"Content-Type:",13)) continue;
+    for(v+=13;*v==' ';v++);
+    rv->ctype=strdup(v);
+    break;
+  }
 
   json_decref(j);
   CFGS=rv;
@@ -117,7 +239,26 @@ void cfg_server_free(cfg_server_t* cfg)
   free(cfg->db);
   free(cfg->socket);
   free(cfg->headers);
+  free(cfg->headers_close);
   free(cfg->h404);
+  free(cfg->h404_close);
+  free(cfg->h304);
+  free(cfg->h304_close);
+  free(cfg->h206);
+  free(cfg->h206_close);
+  free(cfg->h206m);
+  free(cfg->h206m_close);
+  free(cfg->h416);
+  free(cfg->h416_close);
+  free(cfg->ctype);
+  free(cfg->metrics_socket);
+  free(cfg->health);
+  free(cfg->handoff);
+  free(cfg->log_id);
+  free(cfg->log_file);
+  free(cfg->log_socket);
+  free(cfg->resident_keys);
+  free(cfg->heat_file);
   md_free(cfg);
   CFGS=0;
 }
@@ -2,8 +2,14 @@ typedef struct cfg_build_t
 {
   char* src;
   char* db;
-// size_t parts;
+  int parts;
+  int threads;
+  int fingerprint;
   int dedup;
+  int index;
+  int names;
+  int tile_index;
+  int etag;			//!< bodies without ETag get one, entity tags are indexed for If-None-Match
 } cfg_build_t;
 
 typedef struct cfg_server_t
@@ -14,12 +20,60 @@ typedef struct cfg_server_t
   int inbuf;
   char* headers;
   char* h404;
+  char* headers_close;		//!< variants with Connection: close
+  char* h404_close;
+  char* h304;			//!< Not Modified without final empty line, ETag is appended
+  char* h304_close;
+  char* h206;			//!< Partial Content, range headers and stored headers are appended
+  char* h206_close;
+  char* h206m;			//!< multipart Partial Content without Content-* headers
+  char* h206m_close;
+  char* h416;			//!< Range Not Satisfiable, Content-Range is appended
+  char* h416_close;
+  char* ctype;			//!< Content-Type value of headers or 0, used for multipart parts
   int threads;
   int port;
+  unsigned dbflags;
+  unsigned httpflags;		//!< HTTP_DECODE, HTTP_KEEP_QUERY
+  int scrub;
+  int keepalive;
+  int sendfile;			//!< bodies from this size are sent by sendfile (send_zc for io_uring), 0 disables
+  int backend;			//!< SERVER_BACKEND_EPOLL or SERVER_BACKEND_URING
+  int reuseport;		//!< listener per worker, tcp only
+  int pin;			//!< workers are pinned to cores
+  int steering;			//!< SERVER_STEER_*, needs reuseport and pin
+  int timeout;			//!< ms to receive request or make send progress, 0 disables
+  char* handoff;		//!< unix socket passing listeners to upgraded instance, 0 disables
+  int drain;			//!< ms connections may take to finish after handoff
+  int grace;			//!< ms responses from previous database may take after reload, then their connections are closed, 0 waits for them
+  int io_threads;		//!< threads paging in values not in memory, 0 leaves faults to workers
+
+// page cache residency
+  int resident_index;		//!< DB_RESIDENT_* of index and hash files
+  int resident_names;		//!< DB_RESIDENT_* of names files
+  int resident_data;		//!< DB_RESIDENT_* of values selected by resident_zoom and resident_keys
+  int resident_zoom;		//!< tiles up to this zoom are kept, -1 disables
+  char* resident_keys;		//!< file of keys to keep, one per line, 0 disables
+// heat map
+  char* heat_file;		//!< sampled hits per data block persist here for warmup after restart, 0 disables
+  int heat_interval;		//!< ms between saves
+  int heat_sample;		//!< one of heat_sample found values is counted
+  int heat_threads;		//!< threads reading hot blocks ahead at start
+  int heat_wait;		//!< listeners open after hot blocks are submitted
 
 // log settings
+  int log_request;		//!< access log of completed requests
+  int log_facility;		//!< syslog facility, used without log_file and log_socket
+  char* log_id;			//!< syslog ident
+  char* log_file;		//!< append lines to file instead of syslog
+  char* log_socket;		//!< send lines as datagrams to unix socket instead of syslog
+  int log_sample;		//!< one of log_sample requests is logged
+  int log_ring;			//!< records per worker, rounded up to power of 2, full ring drops
 // metrics
+  char* metrics_socket;		//!< address of metrics listener, unix socket path if metrics_port is 0, 0 disables
+  int metrics_port;
 // health
+  char* health;			//!< path on metrics listener answering 200 until shutdown
 } cfg_server_t;
 
 
@@ -5,3 +5,6 @@
 #define DB_IDX_RECORD_LEN	uint32_t
 #define DB_IDX_RECORD_NAME	uint16_t
 #define DB_MMAP_FLAGS		0
+#define DB_CHUNK_BITS		20
+// hash engine of new databases: 0 - cmph with PHASH_ALGO, 1 - in-tree partitioned mphf; both can be opened
+#define PHASH_ENGINE		1
@@ -0,0 +1,160 @@
+
+//! \file
+//! connection state and request handling shared by server backends
+
+#define CTRL_FLAG_SHUTDOWN 1u
+#define CTRL_FLAG_RELOAD   2u
+#define CTRL_FLAG_DRAIN    4u	//!< listeners are handed off, workers exit when their connections end
+
+//! provided recv buffers one io_uring connection may hold while its input buffer is full
+#define CONN_HOLD	4
+//! ranges of one request served as multipart, more are answered with whole record
+#define CONN_RANGES	8
+//! response pieces: status, generated and stored headers, body slices with part headers, closing boundary
+#define CONN_IOV	(2*CONN_RANGES+4)
+//! generated response headers of one connection
+#define CONN_SCRATCH	2048
+//! timer wheel slots, power of 2
+#define WHEEL_SLOTS	256
+//! while draining, connections idle for this long between requests are closed
+#define DRAIN_IDLE_MS	200
+
+typedef enum conn_type_t
+{
+  CONN_SOCKET=0,
+  CONN_LISTEN,
+  CONN_SIGNAL,
+  CONN_WAKE,
+} conn_type_t;
+
+typedef enum conn_state_t
+{
+  STATE_RECV,
+  STATE_LOOKUP,
+  STATE_SEND,
+  STATE_PAGE,			//!< value is paged in by I/O thread
+  STATE_CLOSE
+} conn_state_t;
+
+typedef struct conn_t
+{
+  conn_type_t type;
+  int fd;			//!< socket, registered file index for io_uring
+  conn_state_t state;
+
+  void* buf;
+  size_t szin;
+  size_t rlen;			//!< bytes of current request in buf
+  int close;			//!< close after response
+  int out;			//!< EPOLLOUT is armed
+
+  size_t scanned;		//!< bytes of buf searched for end of request
+  http_req_t req;
+
+  struct iovec iov[CONN_IOV];	//!< response pieces, advanced in place while sent
+  uint32_t niov;
+  uint32_t cur;			//!< first piece not sent completely
+  int body_fd;			//!< last piece is sent from file by sendfile, -1 from memory
+  off_t body_off;		//!< file position of unsent part of last piece
+  char* scratch;		//!< CONN_SCRATCH bytes after input buffer
+  uint64_t start;		//!< metrics_clock at first byte of request, 0 until it arrives
+  int status;			//!< HTTP status of response
+  size_t sent;			//!< bytes of response sent
+  uint64_t gen;			//!< database generation response points into, 0 if none
+  db_value_t val;		//!< looked up value while it is paged in
+
+// io_uring backend
+  int pending;			//!< submitted operations not finished yet
+  struct msghdr msg;
+  uint16_t hold[CONN_HOLD];	//!< received buffers waiting for room in buf
+  uint32_t hold_len[CONN_HOLD];
+  uint32_t hold_off;
+  uint32_t nhold;
+  int recv;			//!< recv is armed
+  struct conn_t* snext;		//!< connections waiting for provided buffers
+  struct conn_t** sprev;	//!< 0 if not waiting
+
+  uint64_t deadline;		//!< monotonic ms of eviction
+  struct conn_t* tnext;		//!< timer wheel slot list
+  struct conn_t** tprev;	//!< 0 if not in wheel
+
+  struct conn_t* next;		//!< pool freelist
+} conn_t;
+
+//! hashed timer wheel of connection deadlines, extended deadlines move entry when its slot expires
+typedef struct wheel_t
+{
+  conn_t* slot[WHEEL_SLOTS];
+  uint64_t now;			//!< monotonic ms, updated once per loop round
+  uint64_t done;		//!< ticks expired so far
+  unsigned shift;		//!< tick is 1<<shift ms
+  uint32_t timeout;		//!< ms, 0 disables
+  size_t count;
+} wheel_t;
+
+//! per worker connections, slab slot holds conn_t followed by its input buffer and scratch
+typedef struct conn_pool_t
+{
+  conn_t* free;
+  conn_t** fds;			//!< live connections by descriptor
+  size_t nfds;
+  size_t live;
+  void** slabs;
+  size_t nslabs;
+  size_t slot;			//!< cache line rounded slot size
+  size_t inbuf;
+} conn_pool_t;
+
+//! worker side of database replacement, worker uses one generation per loop round
+typedef struct db_reader_t
+{
+  _Atomic uint64_t seen;	//!< oldest generation responses of worker still point into
+  _Atomic uint64_t cut;		//!< connections sending responses of generations below are closed, 0 if none
+  int efd;			//!< wakes worker for new generation, shutdown and paged in values
+  db_t* db;			//!< database of current generation
+  uint64_t gen;
+  size_t refs[2];		//!< responses in flight by generation parity
+  uint32_t heat;		//!< sampling state of db_heat
+} __attribute__((aligned(64))) db_reader_t;
+
+//! worker thread argument
+typedef struct worker_arg_t
+{
+  const cfg_server_t* cfg;
+  size_t id;
+  int lfd;			//!< own listener with reuseport, shared one otherwise
+  int cpu;			//!< pinned core or -1
+  db_reader_t* reader;
+} worker_arg_t;
+
+struct pager_queue_t;
+
+extern int sfd;
+extern _Atomic uint32_t ctrl_flags;
+
+int conn_parse(const cfg_server_t* cfg,conn_t* c);
+void conn_next(const cfg_server_t* cfg,conn_t* c);
+int conn_respond(const cfg_server_t* cfg,conn_t* c,const db_value_t* v);
+int conn_sent(conn_t* c,size_t n);
+int conn_page(struct pager_queue_t* q,db_reader_t* r,conn_t* c,db_value_t* v);
+void conn_lookup(db_reader_t* r,conn_t** pend,size_t np,const char** keys,size_t* lens,db_value_t* vals);
+int server_signal(int sfd);
+
+void conn_pool_init(conn_pool_t* p,size_t inbuf);
+void conn_pool_free(conn_pool_t* p);
+conn_t* conn_alloc(conn_pool_t* p,int fd);
+void conn_release(conn_pool_t* p,conn_t* c);
+
+void reader_enter(db_reader_t* r);
+void reader_hold(db_reader_t* r,conn_t* c);
+void reader_release(db_reader_t* r,conn_t* c);
+void reader_leave(db_reader_t* r);
+uint64_t reader_cut(db_reader_t* r);
+
+void wheel_init(wheel_t* w,uint32_t timeout);
+void wheel_now(wheel_t* w);
+void wheel_arm(wheel_t* w,conn_t* c);
+void wheel_cancel(wheel_t* w,conn_t* c);
+void wheel_expire(wheel_t* w,void (*fn)(void*,conn_t*),void* arg);
+
+void* worker_uring(void* arg);
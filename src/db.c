@@ -2,12 +2,16 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <xxhash.h>
 #include <cmph.h>
@@ -19,14 +23,49 @@
 #include "config.h"
 #include "db.h"
 #include "cfg.h"
+#include "mphf.h"
 
 #define DB_MAGIC_INDEX	0xf0caec0dU
 #define DB_MAGIC_DATA	0xfecaec0dU
 #define DB_MAGIC_NAMES	0xfccaec0dU
 #define DB_MAGIC_HASH	0xfdcaec0dU
+#define DB_MAGIC_HEAT	0xfacaec0dU
 
 #define DB_SEED		0xdeadc0deU
+#define DB_SEED_PART	0x0decca01U
+#define DB_SEED_ETAG	0x0decca02U
 
+#define DB_VERSION	1
+#define DB_HEADER0	52	//!< header size of files before version 1, payload follows it directly
+
+#define DB_CHUNK_UNKNOWN	0
+#define DB_CHUNK_OK		1
+#define DB_CHUNK_BAD		2
+
+#define DB_BATCH	16
+#define DB_MINCORE	256	//!< pages per mincore call
+#define DB_HEAT_BITS	16	//!< data block of one heat counter
+#define DB_PIN_HASH_ZOOM	10	//!< deepest zoom enumerated for hashed tiles, 1.4M lookups
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ	22
+#endif
+
+#define DB_HASH_CMPH	0	//!< cmph_dump form written by no released build, not opened
+#define DB_HASH_MPHF	1
+#define DB_HASH_CMPH_PACKED	2
+
+#define DB_IDX_WIDE	0	//!< db_idx_record_t followed by fingerprint
+#define DB_IDX_PACKED	1	//!< bit fields off, noff, len, nlen, fp of rec_bits widths
+#define DB_IDX_TILES	2	//!< tile directory of db_tile_entry_t by tile id, sampled ids follow
+#define DB_IDX_TAIL	8	//!< packed index slack, fields are read by unaligned 64 bit loads
+#define DB_IDX_MAXBITS	57	//!< widest field one shifted 64 bit load can hold
+
+#define DB_NAMES_BLOCK	16	//!< names per front coded block
+
+#define DB_TILE_BLOCK	64	//!< directory entries per sampled id
+#define DB_TILE_GROUP	12	//!< low tile id bits kept in one part
+#define DB_TILE_MAXZOOM	30
 
 typedef struct db_header_t
 {
@@ -37,9 +76,25 @@ typedef struct db_header_t
   uint32_t records;
   uint64_t created;
   uint64_t size;
-  uint64_t hash;
+  uint64_t hash;		//!< hash of chunk checksums table
+  uint16_t version;
+  uint16_t chunk_bits;
+  uint32_t chunks;
+  uint64_t offset;		//!< payload offset, header and chunk table are before
+  uint8_t fp_bits;		//!< index: key fingerprint bits stored after record, 0, 16 or 32
+  uint8_t rec_size;		//!< index: record size including fingerprint
+  uint8_t hash_algo;		//!< hash: DB_HASH_*
+  uint8_t rec_layout;		//!< index: DB_IDX_*
+  uint8_t rec_bits[4];		//!< index: packed widths of off, noff, len, nlen
+  uint8_t names_layout;		//!< names: DB_NAMES_*
+  uint8_t names_block;		//!< names: names per front coded block
+  uint64_t tags;		//!< index: payload offset of entity tag hash per record, 0 if none
+  uint64_t heads;		//!< index: payload offset of uint32_t header length per record, 0 if none
+  uint8_t reserved[34];
 } __attribute__((packed)) db_header_t;
 
+_Static_assert(sizeof(db_header_t)==128,"db_header_t size changed");
+
 typedef struct db_idx_record_t
 {
   DB_IDX_RECORD_OFFSET off;
@@ -48,30 +103,132 @@ typedef struct db_idx_record_t
   DB_IDX_RECORD_NAME nlen;
 } __attribute__((packed)) db_idx_record_t;
 
+//! run of consecutive tile ids sharing one data blob
+typedef struct db_tile_entry_t
+{
+  uint64_t id;
+  uint64_t off;
+  uint32_t len;
+  uint32_t run;
+} __attribute__((packed)) db_tile_entry_t;
+
+//! decoded index record
+typedef struct db_rec_t
+{
+  uint64_t off;
+  uint64_t noff;
+  uint64_t len;
+  uint64_t nlen;
+  uint32_t fp;
+} db_rec_t;
+
+//! index record layout of part
+typedef struct db_layout_t
+{
+  unsigned kind;
+  size_t stride;
+  unsigned fp_bits;
+  uint16_t pos[5];
+  uint64_t mask[5];
+} db_layout_t;
+
 
 typedef struct db_file_t
 {
   int fd;
+  int dfd;			//!< O_DIRECT descriptor for scrubbing, -1 if not available
   void* data;
   size_t sz;
+  void* payload;
+  size_t psz;
+  unsigned chunk_bits;
+  size_t chunks;
+  const uint64_t* sums;
+  _Atomic uint8_t* state;	//!< per chunk DB_CHUNK_*, 0 if chunks are not tracked
+  _Atomic uint8_t* heat;	//!< saturating hits per DB_HEAT_BITS block of payload, 0 if not counted
+  size_t blocks;
+  _Atomic int aging;		//!< a heat counter saturated, all halve at next save
+  uintptr_t* locked;		//!< sorted page ranges held by mlock, begin and end pairs
+  size_t nlocked;
+  char* name;
 } db_file_t;
 
+//! minimal perfect hash of a part
+typedef struct db_hash_t
+{
+  cmph_t* cmph;
+  const void* packed;		//!< cmph_pack form, evaluated in place
+  mphf_t* mphf;
+  uint64_t seed;
+  void* data;			//!< serialized mphf owned by builder
+  size_t size;
+} db_hash_t;
+
 typedef struct db_part_t
 {
   db_file_t* index;
   db_file_t* data;
   db_file_t* name;
   size_t record_count;
-  const db_idx_record_t* records;
+  db_layout_t layout;
+  unsigned names_layout;
+  const void* records;
   const void* strings;
-  const void* names;
-  cmph_t* hash;
+  const void* names;		//!< plain names or front coded blocks
+  const uint64_t* blocks;	//!< front coded block offsets from names, nblocks+1 entries
+  size_t nblocks;
+  const uint64_t* roots;	//!< tile directory: id of every DB_TILE_BLOCK entry
+  size_t nroots;
+  const uint64_t* tags;		//!< entity tag hash by record, 0 if none
+  const uint32_t* heads;	//!< stored header length by record, 0 if none
+  db_hash_t hash;
+  db_file_t* hfile;
 } db_part_t;
 
+typedef struct db_scrub_t
+{
+  db_t* db;
+  db_file_t** files;
+  size_t nfiles;
+  size_t chunks;
+  size_t threads;
+  int background;
+  pthread_t* tp;
+  _Atomic size_t next;
+  _Atomic size_t bad;
+  _Atomic int stop;
+} db_scrub_t;
+
+//! block of heat map, warmup order
+typedef struct db_block_t
+{
+  uint32_t part;
+  uint32_t block;
+} db_block_t;
+
+typedef struct db_warm_t
+{
+  db_t* db;
+  db_block_t* blocks;
+  size_t n;
+  size_t threads;
+  pthread_t* tp;
+  uint64_t t0;
+  _Atomic size_t next;
+  _Atomic size_t left;		//!< threads still running, last one reports
+  _Atomic int stop;
+} db_warm_t;
+
 struct db_t
 {
   size_t cnt;
   db_part_t* parts;
+  unsigned flags;
+  int tiles;
+  db_scrub_t* scrub;
+  unsigned heat_sample;		//!< one of heat_sample found values is counted, 0 if heat map is off
+  db_warm_t* warm;
+  uintptr_t page;		//!< page size for mincore
 };
 
 typedef struct db_tmphash_t
@@ -139,43 +296,162 @@ static uint64_t xx(const void* d,uint64_t s)
   return hash;
 }
 
+uint64_t db_etag(const char* tag,size_t len)
+{
+  if(len>=2 && tag[0]=='W' && tag[1]=='/')
+  {
+    tag+=2;
+    len-=2;
+  }
+  uint64_t h=XXH3_64bits_withSeed(tag,len,DB_SEED_ETAG);
+  return h ? h : 1;
+}
+
+//! tag of ETag header line of stored record, 0 if it has none
+static uint64_t db_record_etag(const char* r,size_t len)
+{
+  const char* e=r+len;
+  for(const char* l=r;l<e;)
+  {
+    const char* le=memchr(l,'\r',e-l);
+    if(!le || le==l) break;
+    if(le-l>5 && !strncasecmp(l,"ETag:",5))
+    {
+      const char* v=l+5;
+      while(v<le && (*v==' ' || *v=='\t')) v++;
+      while(le>v && (le[-1]==' ' || le[-1]=='\t')) le--;
+      return db_etag(v,le-v);
+    }
+    l=le+2;
+  }
+  return 0;
+}
+
+//! length of stored headers including empty line, 0 if record has none
+static uint32_t db_record_head(const char* r,size_t len)
+{
+  const char* e=memmem(r,len,"\r\n\r\n",4);
+  return e && e+4-r<=UINT32_MAX ? e+4-r : 0;
+}
+
+static size_t db_file_chunk_len(const db_file_t* f,size_t c)
+{
+  size_t o=c<<f->chunk_bits;
+  size_t l=1ULL<<f->chunk_bits;
+  return o+l>f->psz ? f->psz-o : l;
+}
+
+//! verify one chunk, from buf with direct io if provided, otherwise from mapping
+static int db_chunk_verify(db_file_t* f,size_t c,void* buf)
+{
+  size_t l=db_file_chunk_len(f,c);
+  const void* d=f->payload+(c<<f->chunk_bits);
+
+  if(buf && f->dfd>=0)
+  {
+    size_t rl=GROW_GETSIZE(4096,l);
+    if(pread(f->dfd,buf,rl,f->payload-f->data+(c<<f->chunk_bits))>=(ssize_t)l) d=buf;
+  }
+
+  int ok=xx(d,l)==f->sums[c];
+  if(f->state) atomic_store_explicit(f->state+c,ok ? DB_CHUNK_OK : DB_CHUNK_BAD,memory_order_relaxed);
+  if(!ok) $msg("%s: chunk %zu checksum mismatch",f->name,c);
+  return !ok;
+}
+
+//! lazy check of payload range, verifies unknown chunks on first access
+static inline int db_file_touch(db_file_t* f,size_t off,size_t len)
+{
+  if(!f->state || !len) return 0;
+  for(size_t c=off>>f->chunk_bits,e=(off+len-1)>>f->chunk_bits;c<=e;c++)
+  {
+    uint8_t s=atomic_load_explicit(f->state+c,memory_order_relaxed);
+    if(s==DB_CHUNK_OK) continue;
+    if(s==DB_CHUNK_BAD || db_chunk_verify(f,c,0)) return -1;
+  }
+  return 0;
+}
+
+static void db_file_track(db_file_t* f)
+{
+  if(!f->state && f->chunks) f->state=md_calloc(f->chunks);
+}
+
+//! mapped file with checked header, 0 on error with reason logged
 static db_file_t* db_file_open(const char* fn)
 {
   struct stat st;
 
-  if(stat(fn,&st) || ! (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) || st.st_size<=sizeof(db_header_t)) $abort("stat file error");
+  if(stat(fn,&st) || ! (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) || st.st_size<=DB_HEADER0)
+  {
+    $msg("%s: stat file error: %m",fn);
+    return 0;
+  }
   int fd=open(fn, O_RDONLY);
-  if(fd== -1) $abort("open file error");
-  void* data=mmap(0,st.st_size,PROT_READ,MAP_PRIVATE|DB_MMAP_FLAGS,fd,0);
+  if(fd== -1)
+  {
+    $msg("%s: open file error: %m",fn);
+    return 0;
+  }
+  void* data=mmap(0,st.st_size,PROT_READ,MAP_SHARED|DB_MMAP_FLAGS,fd,0);
   if(data==MAP_FAILED)
   {
+    $msg("%s: mmap file error: %m",fn);
     close(fd);
-    $abort("mmap file error");
+    return 0;
   }
 
+// before first access, default readahead would pull megabytes after the header in
+  madvise(data,st.st_size,MADV_RANDOM);
+
+  const db_header_t* h=data;
+  const char* err=0;
+  if((h->magic&0xffffff)!=0xcaec0dU) err="no valid signature";
+// size is at the same place in both forms, version 1 payload starts at a page boundary
+  else if(h->size+DB_HEADER0==(uint64_t)st.st_size) err="database format before version 1, rebuild database";
+  else if(st.st_size<=sizeof(db_header_t)) err="integrity check failed, broken header";
+  else if(h->version!=DB_VERSION) err="database format version mismatch, rebuild database";
+  else if(h->offset<sizeof(db_header_t)+h->chunks*sizeof(uint64_t) || h->offset>st.st_size || h->chunk_bits<12 || h->chunk_bits>40) err="integrity check failed, broken header";
+  else if(h->chunks!=(h->size ? ((h->size-1)>>h->chunk_bits)+1 : 0)) err="integrity check failed, broken header";
+  else
   {
-    const db_header_t* h=data;
-    const void* d=data+sizeof(db_header_t);
-    uint64_t hash=xx(d,st.st_size-sizeof(db_header_t));
-    if((h->magic&0xffffff)!=0xcaec0dU) $abort("no valid signature");
-    if(h->hash!=hash) $abort("integrity check failed, hash mismatch");
+    madvise(data,h->offset,MADV_WILLNEED);
+    uint64_t hash=xx(data+sizeof(db_header_t),h->chunks*sizeof(uint64_t));
+    if(h->hash!=hash) err="integrity check failed, hash mismatch";
+  }
+  if(err)
+  {
+    $msg("%s: %s",fn,err);
+    munmap(data,st.st_size);
+    close(fd);
+    return 0;
   }
-
-  madvise(data,st.st_size,MADV_RANDOM|MADV_WILLNEED);
 
   db_file_t* rv=md_new(rv);
   rv->fd=fd;
+  rv->dfd=-1;
   rv->data=data;
   rv->sz=st.st_size;
+  rv->payload=data+h->offset;
+  rv->psz=st.st_size-h->offset;
+  rv->chunk_bits=h->chunk_bits;
+  rv->chunks=h->chunks;
+  rv->sums=data+sizeof(db_header_t);
+  rv->name=md_strdup(fn);
 
   return rv;
 }
 
-static db_file_t* db_file_create(const char* fn,size_t sz)
+//! create file for payload of sz bytes, chunk table is reserved in front of it
+static db_file_t* db_file_create(const char* fn,size_t psz)
 {
   struct stat st;
   if(!stat(fn,&st)) $abort("file exists");
 
+  size_t chunks=psz ? ((psz-1)>>DB_CHUNK_BITS)+1 : 0;
+  size_t offset=GROW_GETSIZE(4096,sizeof(db_header_t)+chunks*sizeof(uint64_t));
+  size_t sz=offset+psz;
+
   int fd=open(fn,O_RDWR | O_CREAT | O_TRUNC,(mode_t)0660);
   if(fd == -1) $abort("create file error");
 
@@ -192,24 +468,64 @@ static db_file_t* db_file_create(const char* fn,size_t sz)
     $abort("mmap file error");
   }
 
-  madvise(data,sz,MADV_RANDOM|MADV_WILLNEED);
+  madvise(data,sz,MADV_RANDOM);
 
   db_file_t* rv=md_new(rv);
   rv->fd=fd;
+  rv->dfd=-1;
   rv->data=data;
   rv->sz=sz;
+  rv->payload=data+offset;
+  rv->psz=psz;
+  rv->chunk_bits=DB_CHUNK_BITS;
+  rv->chunks=chunks;
+  rv->name=md_strdup(fn);
 
   return rv;
 }
 
+//! checksum first size bytes of payload and write header with chunk table
+static void db_file_seal(db_file_t* f,db_header_t* h,size_t size)
+{
+  uint64_t* sums=f->data+sizeof(db_header_t);
+
+  f->psz=size;
+  f->chunks=size ? ((size-1)>>f->chunk_bits)+1 : 0;
+  for(size_t i=0;i<f->chunks;i++) sums[i]=xx(f->payload+(i<<f->chunk_bits),db_file_chunk_len(f,i));
+
+  h->version=DB_VERSION;
+  h->size=size;
+  h->chunk_bits=f->chunk_bits;
+  h->chunks=f->chunks;
+  h->offset=f->payload-f->data;
+  h->hash=xx(sums,f->chunks*sizeof(uint64_t));
+  memcpy(f->data,h,sizeof(*h));
+}
+
 static void db_file_free(db_file_t* dbf)
 {
+  if(!dbf) return;
   munmap(dbf->data,dbf->sz);
   close(dbf->fd);
+  if(dbf->dfd>=0) close(dbf->dfd);
+  md_free((void*)dbf->state);
+  md_free((void*)dbf->heat);
+  md_free(dbf->locked);
+  md_free(dbf->name);
   md_free(dbf);
 }
 
-static int lineparse(char* bf,uint64_t* names,uint64_t* headers,uint64_t* bodies,char* pathbuf)
+static const char* content_length="Content-Length: %ld\r\n";
+static const char* etag_header="ETag: \"%016lx\"\r\n";
+#define DB_ETAG_LINE	26	//!< length of generated etag_header
+
+//! Content-Length is generated, source value would duplicate it
+static inline int lineparse_skip(const char* h)
+{
+  return !strncasecmp(h,"Content-Length:",15);
+}
+
+static int lineparse(char* bf,uint64_t* names,uint64_t* headers,uint64_t* bodies,int etag,char* pathbuf)
 {
   char* state=0;
   {
@@ -230,16 +546,22 @@ static int lineparse(char* bf,uint64_t* names,uint64_t* headers,uint64_t* bodies
 //  free(p);
 
   *bodies+=st.st_size;
-  *headers+=2;
+  *headers+=2+snprintf(0,0,content_length,(long)st.st_size);
 
   char* h=0;
   while(h=strtok_r(0,"\t",&state))
+  {
+    if(lineparse_skip(h)) continue;
+    if(!strncasecmp(h,"ETag:",5)) etag=0;
     *headers+=2+strlen(h);
+  }
+  if(etag) *headers+=DB_ETAG_LINE;
 
   return 0;
 }
 
-static int lineparse2(char* bf,void* dst,void* ndst,size_t* name,size_t* body,uint64_t* dedup,char* pathbuf)
+//! etag reserves line for ETag of body if source has no own one
+static int lineparse2(char* bf,void* dst,void* ndst,size_t* name,size_t* body,uint64_t* dedup,int etag,char* pathbuf)
 {
   char* state=0;
   {
@@ -263,16 +585,25 @@ static int lineparse2(char* bf,void* dst,void* ndst,size_t* name,size_t* body,ui
   if(stat(p,&st) || ! (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))) $abort(fn);
 
 //  *bodies+=st.st_size;
-  *body=0;
+  *body=sprintf(next,content_length,(long)st.st_size);
+  next+=*body;
 
   char* h=0;
   while(h=strtok_r(0,"\t",&state))
   {
+    if(lineparse_skip(h)) continue;
+    if(!strncasecmp(h,"ETag:",5)) etag=0;
     size_t l=strlen(h);
     next=mempcpy(next,h,l);
     next=mempcpy(next,"\r\n",2);
     *body+=l+2;
   }
+  char* tag=etag ? next : 0;
+  if(tag)
+  {
+    next+=DB_ETAG_LINE;
+    *body+=DB_ETAG_LINE;
+  }
   next=mempcpy(next,"\r\n",2);
   *body+=2;
 
@@ -280,589 +611,2283 @@ static int lineparse2(char* bf,void* dst,void* ndst,size_t* name,size_t* body,ui
   if(!f || fread(next,st.st_size,1,f)!=1) $abort(p);
   fclose(f);
 
+  if(tag)
+  {
+    char t[DB_ETAG_LINE+1];
+    snprintf(t,sizeof(t),etag_header,xx(next,st.st_size));
+    memcpy(tag,t,DB_ETAG_LINE);
+  }
+
   *body+=st.st_size;
   if(dedup) *dedup=xx(dst,*body);
 
   return 0;
 }
 
-//! return error string
-int db_build(const cfg_build_t* c)
+//! per-part sizes collected by the first pass over the source
+typedef struct db_part_stat_t
 {
-  if(!c) $abort("no conig to build");
+  size_t items;
+  uint64_t names;
+  uint64_t headers;
+  uint64_t bodies;
+  uint64_t maxlen;		//!< longest headers+body
+  uint64_t maxname;		//!< longest name including terminator
+} db_part_stat_t;
+
+typedef struct db_build_task_t db_build_task_t;
+typedef int db_part_builder_t(db_build_task_t*,size_t);
+
+//! shared state of parallel part builders
+struct db_build_task_t
+{
+  const cfg_build_t* cfg;
+  db_part_stat_t* stat;
+  uuid_t uuid;
+  uint64_t created;
+  size_t hash_threads;
+  int sparse;			//!< empty parts are allowed
+  db_part_builder_t* build;
+  _Atomic size_t next;
+};
 
-  uint64_t t0=utils_time_abs();
+//! files of one part under construction
+typedef struct db_part_build_t
+{
+  char* name_hash;
+  char* name_idx;
+  char* name_data;
+  char* name_names;
+
+  db_file_t* fidx;
+  db_file_t* fdata;
+  db_file_t* fnames;
+
+  db_header_t hidx;
+  db_header_t hdata;
+  db_header_t hhash;
+  db_header_t hname;
+
+  void* start_data;
+  void* start_names;
+  void* start_idx;
+  uint64_t* tags;		//!< entity tag hash by record, 0 if disabled
+  uint32_t* heads;		//!< stored header length by record
+  db_layout_t layout;
+  unsigned names_layout;
+  uint64_t* slot_names;		//!< arena offset of name per slot, names are sorted at finish
+} db_part_build_t;
+
+
+//! key hash, selects part and gives fingerprint
+static inline uint64_t db_key_hash(const void* key,size_t klen)
+{
+  return XXH3_64bits_withSeed(key,klen,DB_SEED_PART);
+}
 
-  char uuid[37];
-  uuid_t u;
-  uuid_generate_random(u);
-  uuid_unparse_lower(u,uuid);
-  $msg("create database %s, source=%s, uuid=%s",c->db,c->src,uuid);
+//! top level key distribution between parts
+static inline size_t db_hash_part(uint64_t h,size_t parts)
+{
+  return ((unsigned __int128)h*parts)>>64;
+}
 
-  size_t items=0;
-  uint64_t names=0;
-  uint64_t headers=0;
-  uint64_t bodies=0;
+static inline size_t db_part_of(const void* key,size_t klen,size_t parts)
+{
+  if(parts<2) return 0;
+  return db_hash_part(db_key_hash(key,klen),parts);
+}
 
-  mkdir(c->db,0770);
-  FILE* f=fopen(c->src,"r");
-  if(!f) $abort("no source");
-  char pathbuf[PATH_MAX+1];
-  size_t l=0;
-  char* bf=0;
+static inline uint32_t db_hash_fp(uint64_t h,unsigned bits)
+{
+  return bits==16 ? (uint16_t)h : (uint32_t)h;
+}
 
-  while(getline(&bf,&l,f)>0)
+static inline unsigned db_bits(uint64_t v)
+{
+  return v ? 64-__builtin_clzll(v) : 1;
+}
+
+//! layout from index header, header is validated
+static int db_layout_init(db_layout_t* l,const db_header_t* h)
+{
+  memset(l,0,sizeof(*l));
+  l->kind=h->rec_layout;
+  l->stride=h->rec_size;
+  l->fp_bits=h->fp_bits;
+
+  if(l->fp_bits!=0 && l->fp_bits!=16 && l->fp_bits!=32) return -1;
+  if(l->kind==DB_IDX_WIDE) return l->stride==sizeof(db_idx_record_t)+l->fp_bits/8 ? 0 : -1;
+  if(l->kind==DB_IDX_TILES) return l->stride==sizeof(db_tile_entry_t) && !l->fp_bits ? 0 : -1;
+  if(l->kind!=DB_IDX_PACKED) return -1;
+
+  unsigned pos=0;
+  for(size_t i=0;i<5;i++)
   {
-    if(lineparse(bf,&names,&headers,&bodies,pathbuf))
-    {
-      $msg("can not parse line %s",bf);
-      $abort("input format error");
-    }
-    items++;
+    unsigned bits=i<4 ? h->rec_bits[i] : l->fp_bits;
+    if(i<4 && (!bits || bits>DB_IDX_MAXBITS)) return -1;
+    l->pos[i]=pos;
+    l->mask[i]=bits ? (1ULL<<bits)-1 : 0;
+    pos+=bits;
   }
+  return pos<=l->stride*8 ? 0 : -1;
+}
 
-  $msg("records %zd, names %ld, headers %ld, bodies %ld",items,names,headers,bodies);
-  char** pidx=md_pcalloc(items);
-  char* arena=md_calloc(names);
-  rewind(f);
-
-  uint64_t i=0;
-  uint64_t n=0;
-
-  while(getline(&bf,&l,f)>0)
+//! choose field widths from upper bounds of values, fills header
+static void db_layout_build(db_layout_t* l,db_header_t* h,int index,unsigned fp_bits,const db_part_stat_t* ps,uint64_t noff)
+{
+  h->fp_bits=fp_bits;
+  if(index==DB_INDEX_WIDE)
   {
-    char* p=strchr(bf,'\t');
-    if(!p) $abort(bf);
-    *p++=0;
-    pidx[i++]=arena+n;
-    strcpy(arena+n,bf);
-    n+=strlen(bf)+1;
+    h->rec_layout=DB_IDX_WIDE;
+    h->rec_size=sizeof(db_idx_record_t)+fp_bits/8;
   }
-$$
-  cmph_io_adapter_t *source=cmph_io_vector_adapter(pidx,items);
-  cmph_config_t *config = cmph_config_new(source);
-  cmph_config_set_algo(config,PHASH_ALGO);
-$$
-  cmph_t* hash = cmph_new(config);
-  cmph_config_destroy(config);
-  cmph_io_vector_adapter_destroy(source);
-  if(!hash) $abort("hash generation failed");
-
-// create supplied files
-  char* name_hash=md_sprintf("%s/hash.part0",c->db);
-  char* name_idx=md_sprintf("%s/idx.part0",c->db);
-  char* name_data=md_sprintf("%s/data.part0",c->db);
-  char* name_names=md_sprintf("%s/names.part0",c->db);
-
-  db_file_t* fidx=db_file_create(name_idx,items*sizeof(db_idx_record_t)+sizeof(db_header_t));
-  db_file_t* fdata=db_file_create(name_data,headers+bodies+sizeof(db_header_t));
-  db_file_t* fnames=db_file_create(name_names,names+sizeof(db_header_t));
-
-  void* start_data=fdata->data+sizeof(db_header_t);
-  void* start_names=fnames->data+sizeof(db_header_t);
-  db_idx_record_t* start_idx=fidx->data+sizeof(db_header_t);
-
-  db_header_t hidx={0,};
-  db_header_t hdata={0,};
-  db_header_t hhash={0,};
-  db_header_t hname={0,};
-  hidx.magic=DB_MAGIC_INDEX;
-  hdata.magic=DB_MAGIC_DATA;
-  hhash.magic=DB_MAGIC_HASH;
-  hname.magic=DB_MAGIC_NAMES;
-  hname.parts=hhash.parts=hidx.parts=hdata.parts=1;
-  hname.part=hhash.part=hidx.part=hdata.part=0;
-  hname.created=hhash.created=hidx.created=hdata.created=time(0);
-  hname.records=hhash.records=hidx.records=hdata.records=items;
-  hidx.size=items*sizeof(db_idx_record_t);
-  hdata.size=headers+bodies;
-  hname.size=names;
-
-  memcpy(hdata.uuid,&u,sizeof(u));
-  memcpy(hidx.uuid,&u,sizeof(u));
-  memcpy(hhash.uuid,&u,sizeof(u));
-  memcpy(hname.uuid,&u,sizeof(u));
-
-  {
-    size_t hl=0;
-    char* hd=0;
-    FILE* fhash=open_memstream(&hd,&hl);
-    cmph_dump(hash,fhash);
-    fclose(fhash);
-
-    hhash.size=hl;
-    hhash.hash=xx(hd,hl);
-
-    fhash=fopen(name_hash,"wb");
-    if(fwrite(&hhash,sizeof(hhash),1,fhash)!=1) $abort(name_hash);
-    if(fwrite(hd,hl,1,fhash)!=1) $abort(name_hash);
-    fclose(fhash);
-
-    free(hd);
-  }
-  md_free(pidx);
-  md_free(arena);
-
-  rewind(f);
-
-  size_t off=0;
-  size_t noff=0;
-  size_t final=0;
-
+  else
   {
-    db_tmphash_t* root=0;
-    uint64_t dhash;
-    while(getline(&bf,&l,f)>0)
-    {
-      size_t nsz=0;
-      size_t bsz=0;
-      lineparse2(bf,start_data+off,start_names+noff,&nsz,&bsz,c->dedup ? &dhash : 0,pathbuf);
-      ssize_t q=cmph_search(hash,bf,nsz);
-
-      if(q<0) $abort(bf);  //hash integrity broken
-      start_idx[q].noff=noff;
-      start_idx[q].nlen=nsz;
-      noff+=nsz+1;
+    h->rec_layout=DB_IDX_PACKED;
+    h->rec_bits[0]=db_bits(ps->headers+ps->bodies);
+    h->rec_bits[1]=db_bits(noff);
+    h->rec_bits[2]=db_bits(ps->maxlen);
+    h->rec_bits[3]=db_bits(ps->maxname);
+    unsigned bits=h->rec_bits[0]+h->rec_bits[1]+h->rec_bits[2]+h->rec_bits[3]+fp_bits;
+    if(h->rec_bits[0]>DB_IDX_MAXBITS || h->rec_bits[1]>DB_IDX_MAXBITS) $abort("part too large for packed index");
+
+    size_t sz=(bits+7)/8;
+// power of two sizes never cross a cache line
+    if(index==DB_INDEX_ALIGNED && sz<=64)
+      sz=sz<=4 ? 4 : 1ULL<<db_bits(sz-1);
+    h->rec_size=sz;
+  }
+  if(db_layout_init(l,h)) $abort("index layout");
+}
 
-      if(c->dedup)
-      {
-        db_tmphash_t* r=0;
-        HASH_FIND(hh,root,&dhash,sizeof(dhash),r);
-        if(!r)
-        {
-          r=md_new(r);
-          r->h=dhash;
-          r->off=off;
-          r->len=bsz;
-          HASH_ADD_KEYPTR(hh,root,&r->h,sizeof(r->h),r);
-          start_idx[q].len=bsz;
-          start_idx[q].off=off;
-          off+=bsz;
-        }
-        else
-        {
-          start_idx[q].len=r->len;
-          start_idx[q].off=r->off;
-        }
-      }
-      else
-      {
-        start_idx[q].len=bsz;
-        start_idx[q].off=off;
-        off+=bsz;
-      }
-    }
+static inline size_t db_layout_size(const db_layout_t* l,size_t records)
+{
+  if(l->kind==DB_IDX_TILES) return records*l->stride+(records+DB_TILE_BLOCK-1)/DB_TILE_BLOCK*sizeof(uint64_t);
+  return records*l->stride+(l->kind==DB_IDX_PACKED ? DB_IDX_TAIL : 0);
+}
 
-    if(c->dedup)
+//! hilbert curve position of tile, preceded by all tiles of lower zooms as in PMTiles
+static inline uint64_t db_tile_id(unsigned z,uint64_t x,uint64_t y)
+{
+  uint64_t acc=((1ULL<<2*z)-1)/3;
+  uint64_t d=0;
+  for(uint64_t s=(1ULL<<z)/2;s;s/=2)
+  {
+    uint64_t rx=(x&s)!=0;
+    uint64_t ry=(y&s)!=0;
+    d+=s*s*((3*rx)^ry);
+    if(!ry)
     {
-      final=off;
-      while(root)
+      if(rx)
       {
-        db_tmphash_t* l=root;
-        HASH_DELETE(hh,root,l);
-        md_free(l);
+        x=s-1-x;
+        y=s-1-y;
       }
+      uint64_t t=x;
+      x=y;
+      y=t;
     }
   }
+  return acc+d;
+}
 
-  free(bf);
-  fclose(f);
-
-  if(!c->dedup) final=headers+bodies;
-  hdata.size=final;
-
-  hidx.hash=xx(fidx->data+sizeof(db_header_t),items*sizeof(db_idx_record_t));
-  memcpy(fidx->data,&hidx,sizeof(hidx));
-  hdata.hash=xx(fdata->data+sizeof(db_header_t),final);
-  memcpy(fdata->data,&hdata,sizeof(hdata));
-  hname.hash=xx(fnames->data+sizeof(db_header_t),names);
-  memcpy(fnames->data,&hname,sizeof(hname));
+//! groups of neighbour tiles stay in one part
+static inline size_t db_tile_part(uint64_t id,size_t parts)
+{
+  if(parts<2) return 0;
+  uint64_t g=id>>DB_TILE_GROUP;
+  return db_hash_part(XXH3_64bits_withSeed(&g,sizeof(g),DB_SEED_PART),parts);
+}
 
-  db_file_free(fidx);
-  db_file_free(fdata);
-  db_file_free(fnames);
+static inline uint64_t db_field(const void* r,unsigned pos,uint64_t mask)
+{
+  uint64_t v;
+  memcpy(&v,r+(pos>>3),sizeof(v));
+  return (v>>(pos&7))&mask;
+}
 
-  if(c->dedup) truncate(name_data,final+sizeof(db_header_t));
+static inline void db_field_put(void* r,unsigned pos,uint64_t mask,uint64_t x)
+{
+  if(x>mask) $abort("index field overflow");
+  uint64_t v;
+  memcpy(&v,r+(pos>>3),sizeof(v));
+  v|=x<<(pos&7);
+  memcpy(r+(pos>>3),&v,sizeof(v));
+}
 
-  md_free(name_hash);
-  md_free(name_idx);
-  md_free(name_data);
-  md_free(name_names);
+static inline void db_record_decode(const db_layout_t* l,const void* r,db_rec_t* x)
+{
+  if(l->kind==DB_IDX_PACKED)
+  {
+    x->off=db_field(r,l->pos[0],l->mask[0]);
+    x->noff=db_field(r,l->pos[1],l->mask[1]);
+    x->len=db_field(r,l->pos[2],l->mask[2]);
+    x->nlen=db_field(r,l->pos[3],l->mask[3]);
+    x->fp=db_field(r,l->pos[4],l->mask[4]);
+    return;
+  }
 
-  cmph_destroy(hash);
+  const db_idx_record_t* t=r;
+  x->off=t->off;
+  x->noff=t->noff;
+  x->len=t->len;
+  x->nlen=t->nlen;
+  x->fp=0;
+  if(l->fp_bits==16)
+  {
+    uint16_t v;
+    memcpy(&v,t+1,sizeof(v));
+    x->fp=v;
+  }
+  else if(l->fp_bits==32) memcpy(&x->fp,t+1,sizeof(x->fp));
+}
 
+//! record slots start zeroed and are written once
+static inline void db_record_encode(const db_layout_t* l,void* r,const db_rec_t* x)
+{
+  if(l->kind==DB_IDX_PACKED)
   {
-    char *z=utils_time_format(t0);
-    $msg("build done, %s taken",z);
-    free(z);
+    db_field_put(r,l->pos[0],l->mask[0],x->off);
+    db_field_put(r,l->pos[1],l->mask[1],x->noff);
+    db_field_put(r,l->pos[2],l->mask[2],x->len);
+    db_field_put(r,l->pos[3],l->mask[3],x->nlen);
+    db_field_put(r,l->pos[4],l->mask[4],x->fp);
+    return;
   }
 
-  return 0;
+  db_idx_record_t* t=r;
+  t->off=x->off;
+  t->noff=x->noff;
+  t->len=x->len;
+  t->nlen=x->nlen;
+  memcpy(t+1,&x->fp,l->fp_bits/8);
 }
 
-
-static int sqcb(void *data, int argc, char **argv, char **azColName)
+static inline const void* db_record(const db_part_t* p,size_t r)
 {
-  uint64_t* res=data;
-  *res=atoll(argv[0]);
-  return 0;
+  return p->records+r*p->layout.stride;
 }
 
-//! return error string
-int db_build_tiles(const cfg_build_t* c)
+static inline void db_build_record(db_part_build_t* b,size_t q,const void* key,size_t klen,db_rec_t* x)
 {
-  const char* header="Content-Length: %ld\r\nETag: mvt-%016lx\r\n\r\n";
-  const size_t hsz=strlen(header)-3-6+16;  // -%ld -%016lx + 16 hex hash
-  const char* url="/%ld/%ld/%ld.mvt";
-
-  if(!c) $abort("no conig to build");
-
-  uint64_t t0=utils_time_abs();
-
-  char uuid[37];
-  uuid_t u;
-  uuid_generate_random(u);
-  uuid_unparse_lower(u,uuid);
-  $msg("create database %s, source=%s, uuid=%s",c->db,c->src,uuid);
-
-  size_t items=0;
-  uint64_t names=0;
-  uint64_t headers=0;
-  uint64_t bodies=0;
-//  uint64_t records=0;
-  uint64_t tiles=0;
+  x->fp=b->layout.fp_bits ? db_hash_fp(db_key_hash(key,klen),b->layout.fp_bits) : 0;
+  if(b->slot_names)
+  {
+    b->slot_names[q]=x->noff;
+    x->noff=0;
+  }
+  db_record_encode(&b->layout,b->start_idx+q*b->layout.stride,x);
+}
 
-  sqlite3 *db;
+static inline size_t db_varint_len(uint64_t v)
+{
+  size_t n=1;
+  while(v>=0x80)
+  {
+    v>>=7;
+    n++;
+  }
+  return n;
+}
 
-  if(sqlite3_open_v2(c->src, &db,SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,0)!=SQLITE_OK) $abort("SQLite open error");
+static inline uint8_t* db_varint_put(uint8_t* s,uint64_t v)
+{
+  while(v>=0x80)
+  {
+    *s++=v|0x80;
+    v>>=7;
+  }
+  *s++=v;
+  return s;
+}
 
-  sqlite3_exec(db, "PRAGMA query_only=ON;", 0, 0, 0);
-  sqlite3_exec(db, "PRAGMA temp_store=MEMORY;", 0, 0, 0);
-  sqlite3_exec(db, "PRAGMA cache_size=-200000;", 0, 0, 0);   // ~200k страниц
-  sqlite3_exec(db, "PRAGMA mmap_size=1073741824;", 0, 0, 0); // 1 GiB
+static inline const uint8_t* db_varint(const uint8_t* s,uint64_t* v)
+{
+  uint64_t r=0;
+  for(unsigned sh=0;;sh+=7)
+  {
+    uint8_t c=*s++;
+    r|=(uint64_t)(c&0x7f)<<sh;
+    if(!(c&0x80)) break;
+  }
+  *v=r;
+  return s;
+}
 
-  mkdir(c->db,0770);
+static inline size_t db_common(const char* a,size_t al,const char* b,size_t bl)
+{
+  size_t n=al<bl ? al : bl;
+  size_t i=0;
+  while(i<n && a[i]==b[i]) i++;
+  return i;
+}
 
-  sqlite3_stmt *stmt;
+//! qsort_r order of slots by name
+static int db_names_cmp(const void* a,const void* b,void* arg)
+{
+  const db_part_build_t* p=arg;
+  const char* arena=p->start_names;
+  return strcmp(arena+p->slot_names[*(const uint64_t*)a],arena+p->slot_names[*(const uint64_t*)b]);
+}
 
-// headers are Content-Length, ETag = "mvt-" + hex(hash).
-//$msg("header size is %zd",sizeof(db_header_t));
+//! key set collected for hash construction, cmph needs keys, mphf only hashes
+typedef struct db_keys_t
+{
+  size_t n;
+  char** pidx;
+  char* arena;
+  size_t used;
+  mphf_key_t* hashes;
+} db_keys_t;
+
+static void db_keys_init(db_keys_t* k,size_t items,uint64_t names)
+{
+  memset(k,0,sizeof(*k));
+  if(PHASH_ENGINE==DB_HASH_MPHF)
+    k->hashes=md_tmalloc(mphf_key_t,items);
+  else
   {
-    char path[1024];
+    k->pidx=md_pcalloc(items);
+    k->arena=md_calloc(names);
+  }
+}
 
-    sqlite3_exec(db,"select sum(length(tile_data)) from tiles_data;", sqcb, &bodies, 0);
-    sqlite3_exec(db,"select sum(length(length(tile_data))) from tiles_data;", sqcb, &headers, 0);
-    sqlite3_exec(db,"select count(*) from tiles_data;", sqcb, &tiles, 0);
-    sqlite3_exec(db,"select count(*) from tiles_shallow;", sqcb, &items, 0);
+static void db_keys_add(db_keys_t* k,const char* key,size_t klen)
+{
+  if(k->hashes)
+  {
+    k->hashes[k->n++]=mphf_hash(key,klen,DB_SEED);
+    return;
+  }
+  k->pidx[k->n++]=k->arena+k->used;
+  memcpy(k->arena+k->used,key,klen);
+  k->used+=klen+1;
+}
 
-    headers+=tiles*hsz;
+static int db_key_cmp(const void* a,const void* b)
+{
+  return strcmp(*(char* const*)a,*(char* const*)b);
+}
 
-    sqlite3_prepare_v2(db,"select zoom_level,tile_column,tile_row from tiles_shallow;",-1,&stmt,0);
-    while(sqlite3_step(stmt) != SQLITE_DONE)
+//! build hash and release keys, 0 if two keys hash equal, dup then holds hash of one of them for db_dup_check
+static int db_hash_build(db_hash_t* h,db_keys_t* k,size_t threads,mphf_key_t* dup)
+{
+  memset(h,0,sizeof(*h));
+  if(k->hashes)
+  {
+    h->seed=DB_SEED;
+    h->data=mphf_build(k->hashes,k->n,h->seed,threads,&h->size,dup);
+    if(!h->data)
     {
-      uint64_t zoom=sqlite3_column_int(stmt,0);
-      uint64_t col=sqlite3_column_int(stmt,1);
-      uint64_t row=sqlite3_column_int(stmt,2);
-
-      snprintf(path,sizeof(path)-1,url,zoom,col,(1ULL<<zoom)-1-row);
-      names+=strlen(path)+1;
+      if(!dup->lo && !dup->hi) $abort("hash generation failed, no pilot found");
+      return 0;
     }
-    sqlite3_finalize(stmt);
+    h->mphf=mphf_open(h->data,h->size);
+    md_free(k->hashes);
+    return 1;
   }
 
-  $msg("records %zd, names %ld, headers %ld, bodies %ld, uniq tiles %ld",items,names,headers,bodies,tiles);
-  char** pidx=md_pcalloc(items);
-  char* arena=md_calloc(names);
-
-  uint64_t i=0;
-  uint64_t n=0;
+  cmph_io_adapter_t *source=cmph_io_vector_adapter(k->pidx,k->n);
+  cmph_config_t *config = cmph_config_new(source);
+  cmph_config_set_algo(config,PHASH_ALGO);
 
+  h->cmph = cmph_new(config);
+  cmph_config_destroy(config);
+  cmph_io_vector_adapter_destroy(source);
+  if(!h->cmph)
   {
-    char path[1024];
-    sqlite3_prepare_v2(db,"select zoom_level,tile_column,tile_row from tiles_shallow;",-1,&stmt,0);
-    while(sqlite3_step(stmt) != SQLITE_DONE)
-    {
+    qsort(k->pidx,k->n,sizeof(*k->pidx),db_key_cmp);
+    for(size_t i=1;i<k->n;i++)
+      if(!strcmp(k->pidx[i-1],k->pidx[i]))
+      {
+        $msg("duplicate key %s",k->pidx[i]);
+        $abort("hash generation failed, duplicate keys");
+      }
+    $abort("hash generation failed");
+  }
+
+  md_free(k->pidx);
+  md_free(k->arena);
+  return 1;
+}
+
+//! rescan state after db_hash_build found equal hashes
+typedef struct db_dup_t
+{
+  mphf_key_t h;
+  char* first;
+} db_dup_t;
+
+//! aborts on second key of source with hash h, naming it
+static void db_dup_check(db_dup_t* d,const char* key,size_t klen)
+{
+// builder compares low halves within one bucket
+  if(mphf_hash(key,klen,DB_SEED).lo!=d->h.lo) return;
+  if(!d->first)
+  {
+    d->first=strndup(key,klen);
+    return;
+  }
+  if(strlen(d->first)==klen && !memcmp(d->first,key,klen))
+  {
+    $msg("duplicate key %s",d->first);
+    $abort("hash generation failed, duplicate keys");
+  }
+  $msg("keys %s and %.*s hash equal",d->first,(int)klen,key);
+  $abort("hash generation failed, hash collision");
+}
+
+static inline size_t db_hash_search(const db_hash_t* h,const char* key,size_t klen)
+{
+  if(h->mphf) return mphf_lookup(h->mphf,mphf_hash(key,klen,h->seed));
+  if(h->packed) return cmph_search_packed((void*)h->packed,key,klen);
+  return cmph_search(h->cmph,key,klen);
+}
+
+static void db_hash_free(db_hash_t* h)
+{
+  if(h->mphf) mphf_close(h->mphf);
+  if(h->cmph) cmph_destroy(h->cmph);
+  md_free(h->data);
+}
+
+static size_t db_threads(void)
+{
+  long n=sysconf(_SC_NPROCESSORS_ONLN);
+  return n>0 ? n : 1;
+}
+
+static void db_header_init(db_header_t* h,uint32_t magic,const db_build_task_t* t,size_t part,size_t items,uint64_t size)
+{
+  memset(h,0,sizeof(*h));
+  h->magic=magic;
+  memcpy(h->uuid,t->uuid,sizeof(uuid_t));
+  h->parts=t->cfg->parts;
+  h->part=part;
+  h->created=t->created;
+  h->records=items;
+  h->size=size;
+}
+
+//! entity tag hashes and header lengths follow records, aligned
+static void db_index_extra(db_header_t* h,int etag)
+{
+  if(!h->records) return;
+  if(etag)
+  {
+    h->tags=(h->size+7)&~7ULL;
+    h->size=h->tags+h->records*sizeof(uint64_t);
+  }
+  h->heads=(h->size+7)&~7ULL;
+  h->size=h->heads+h->records*sizeof(uint32_t);
+}
+
+//! arrays reserved by db_index_extra in created index
+static void db_index_arrays(db_part_build_t* b)
+{
+  if(b->hidx.tags) b->tags=b->fidx->payload+b->hidx.tags;
+  if(b->hidx.heads) b->heads=b->fidx->payload+b->hidx.heads;
+}
+
+//! entity tag and header length of record stored in slot q
+static inline void db_record_meta(db_part_build_t* b,size_t q,const char* r,size_t len)
+{
+  if(b->tags) b->tags[q]=db_record_etag(r,len);
+  b->heads[q]=db_record_head(r,len);
+}
+
+//! create part files and store hash, data size is upper bound
+static void db_part_create(db_part_build_t* b,const db_build_task_t* t,size_t part,const db_hash_t* hash)
+{
+  const char* db=t->cfg->db;
+  const db_part_stat_t* ps=t->stat+part;
+  size_t items=ps->items;
+  uint64_t names=ps->names;
+  uint64_t data=ps->headers+ps->bodies;
+  memset(b,0,sizeof(*b));
+
+  b->name_hash=md_sprintf("%s/hash.part%zu",db,part);
+  b->name_idx=md_sprintf("%s/idx.part%zu",db,part);
+  b->name_data=md_sprintf("%s/data.part%zu",db,part);
+  b->name_names=md_sprintf("%s/names.part%zu",db,part);
+
+// sorted names are addressed by rank, no names leave noff unused
+  b->names_layout=t->cfg->names;
+  uint64_t noff=b->names_layout==DB_NAMES_PLAIN ? names : b->names_layout==DB_NAMES_FRONT ? items : 0;
+
+  db_header_init(&b->hidx,DB_MAGIC_INDEX,t,part,items,0);
+  db_layout_build(&b->layout,&b->hidx,t->cfg->index,t->cfg->fingerprint,ps,noff);
+  b->hidx.size=db_layout_size(&b->layout,items);
+  db_index_extra(&b->hidx,t->cfg->etag);
+
+  b->fidx=db_file_create(b->name_idx,b->hidx.size);
+  b->fdata=db_file_create(b->name_data,data);
+
+  b->start_data=b->fdata->payload;
+  b->start_idx=b->fidx->payload;
+  db_index_arrays(b);
+
+  if(b->names_layout==DB_NAMES_PLAIN)
+  {
+    b->fnames=db_file_create(b->name_names,names);
+    b->start_names=b->fnames->payload;
+  }
+  else
+  {
+    b->start_names=md_malloc(names);
+    b->slot_names=md_tmalloc(uint64_t,items);
+  }
+
+  db_header_init(&b->hdata,DB_MAGIC_DATA,t,part,items,data);
+  db_header_init(&b->hhash,DB_MAGIC_HASH,t,part,items,0);
+  db_header_init(&b->hname,DB_MAGIC_NAMES,t,part,items,names);
+  b->hname.names_layout=b->names_layout;
+
+  size_t hl=hash->size;
+  char* hd=hash->data;
+  b->hhash.hash_algo=DB_HASH_MPHF;
+  if(hash->cmph)
+  {
+    hl=cmph_packed_size(hash->cmph);
+    hd=md_malloc(hl);
+    cmph_pack(hash->cmph,hd);
+    b->hhash.hash_algo=DB_HASH_CMPH_PACKED;
+  }
+
+  db_file_t* fh=db_file_create(b->name_hash,hl);
+  memcpy(fh->payload,hd,hl);
+  db_file_seal(fh,&b->hhash,hl);
+  db_file_free(fh);
+
+  if(hash->cmph) md_free(hd);
+}
+
+//! sort names collected in arena, write them front coded and store ranks to index records
+static void db_names_front(db_part_build_t* b)
+{
+  size_t n=b->hidx.records;
+  const char* arena=b->start_names;
+  const uint64_t* sn=b->slot_names;
+
+  uint64_t* ord=md_tmalloc(uint64_t,n);
+  for(size_t q=0;q<n;q++) ord[q]=q;
+  qsort_r(ord,n,sizeof(uint64_t),db_names_cmp,b);
+
+  size_t nblocks=(n+DB_NAMES_BLOCK-1)/DB_NAMES_BLOCK;
+  size_t table=(nblocks+1)*sizeof(uint64_t);
+  size_t size=table;
+  for(size_t i=0,prev=0;i<n;i++)
+  {
+    size_t len=strlen(arena+sn[ord[i]]);
+    size_t lcp=i%DB_NAMES_BLOCK ? db_common(arena+sn[ord[i-1]],prev,arena+sn[ord[i]],len) : 0;
+    size+=(i%DB_NAMES_BLOCK ? db_varint_len(lcp) : 0)+db_varint_len(len-lcp)+len-lcp;
+    prev=len;
+  }
+
+  b->fnames=db_file_create(b->name_names,size);
+  uint64_t* blocks=b->fnames->payload;
+  uint8_t* base=b->fnames->payload+table;
+  uint8_t* w=base;
+  for(size_t i=0,prev=0;i<n;i++)
+  {
+    const char* s=arena+sn[ord[i]];
+    size_t len=strlen(s);
+    size_t lcp=0;
+    if(i%DB_NAMES_BLOCK)
+    {
+      lcp=db_common(arena+sn[ord[i-1]],prev,s,len);
+      w=db_varint_put(w,lcp);
+    }
+    else blocks[i/DB_NAMES_BLOCK]=w-base;
+    w=db_varint_put(w,len-lcp);
+    w=mempcpy(w,s+lcp,len-lcp);
+    prev=len;
+
+// rank replaces name offset in record
+    void* r=b->start_idx+ord[i]*b->layout.stride;
+    db_rec_t x;
+    db_record_decode(&b->layout,r,&x);
+    x.noff=i;
+    memset(r,0,b->layout.stride);
+    db_record_encode(&b->layout,r,&x);
+  }
+  blocks[nblocks]=w-base;
+  b->hname.size=size;
+  b->hname.names_block=DB_NAMES_BLOCK;
+
+  md_free(ord);
+}
+
+//! seal headers, final is actual data size
+static void db_part_finish(db_part_build_t* b,uint64_t final)
+{
+  if(b->names_layout==DB_NAMES_FRONT) db_names_front(b);
+  else if(b->names_layout==DB_NAMES_NONE)
+  {
+    b->fnames=db_file_create(b->name_names,0);
+    b->hname.size=0;
+  }
+  if(b->slot_names)
+  {
+    md_free(b->start_names);
+    md_free(b->slot_names);
+  }
+
+  uint64_t reserved=b->hdata.size;
+  size_t offset=b->fdata->payload-b->fdata->data;
+
+  db_file_seal(b->fidx,&b->hidx,b->hidx.size);
+  db_file_seal(b->fdata,&b->hdata,final);
+  if(b->fnames) db_file_seal(b->fnames,&b->hname,b->hname.size);
+
+  db_file_free(b->fidx);
+  db_file_free(b->fdata);
+  if(b->fnames) db_file_free(b->fnames);
+
+  if(final<reserved) truncate(b->name_data,final+offset);
+
+  md_free(b->name_hash);
+  md_free(b->name_idx);
+  md_free(b->name_data);
+  md_free(b->name_names);
+}
+
+static void* db_build_thread(void* arg)
+{
+  db_build_task_t* t=arg;
+  for(size_t p;(p=atomic_fetch_add(&t->next,1))<t->cfg->parts;)
+    if(t->build(t,p)) $abort("part build failed");
+  return 0;
+}
+
+//! run part builders, at most cfg->threads at once
+static void db_build_run(db_build_task_t* t)
+{
+  size_t parts=t->cfg->parts;
+  for(size_t i=0;i<parts;i++)
+  {
+    $msg("part %zu: records %zd, names %ld, headers %ld, bodies %ld",i,t->stat[i].items,t->stat[i].names,t->stat[i].headers,t->stat[i].bodies);
+    if(!t->stat[i].items && !t->sparse) $abort("empty part, decrease number of parts");
+  }
+
+  size_t n=t->cfg->threads>0 && t->cfg->threads<parts ? t->cfg->threads : parts;
+  t->hash_threads=db_threads()/n;
+  if(!t->hash_threads) t->hash_threads=1;
+  pthread_t* tp=md_tcalloc(pthread_t,n);
+  for(size_t i=0;i<n;i++)
+    if(pthread_create(tp+i,0,db_build_thread,t)) $abort("build start");
+  for(size_t i=0;i<n;i++) pthread_join(tp[i],0);
+  md_free(tp);
+}
+
+static int db_build_part(db_build_task_t* t,size_t part)
+{
+  const cfg_build_t* c=t->cfg;
+  const db_part_stat_t* ps=t->stat+part;
+  size_t items=ps->items;
+
+  FILE* f=fopen(c->src,"r");
+  if(!f) $abort("no source");
+  char pathbuf[PATH_MAX+1];
+  size_t l=0;
+  char* bf=0;
+
+  db_keys_t keys;
+  db_keys_init(&keys,items,ps->names);
+
+  while(getline(&bf,&l,f)>0)
+  {
+    char* p=strchr(bf,'\t');
+    if(!p) $abort(bf);
+    *p++=0;
+    if(db_part_of(bf,p-bf-1,c->parts)!=part) continue;
+    db_keys_add(&keys,bf,p-bf-1);
+  }
+  if(keys.n!=items) $abort("source changed during build");
+
+  db_hash_t hash;
+  mphf_key_t dup;
+  if(!db_hash_build(&hash,&keys,t->hash_threads,&dup))
+  {
+    db_dup_t d={dup,0};
+    rewind(f);
+    while(getline(&bf,&l,f)>0)
+    {
+      size_t n=strcspn(bf,"\t");
+      if(db_part_of(bf,n,c->parts)==part) db_dup_check(&d,bf,n);
+    }
+    $abort("hash generation failed, source changed during build");
+  }
+
+  db_part_build_t b;
+  db_part_create(&b,t,part,&hash);
+
+  rewind(f);
+
+  size_t off=0;
+  size_t noff=0;
+
+  {
+    db_tmphash_t* root=0;
+    uint64_t dhash;
+    while(getline(&bf,&l,f)>0)
+    {
+      if(db_part_of(bf,strcspn(bf,"\t"),c->parts)!=part) continue;
+      size_t nsz=0;
+      size_t bsz=0;
+      lineparse2(bf,b.start_data+off,b.start_names+noff,&nsz,&bsz,c->dedup ? &dhash : 0,c->etag,pathbuf);
+      size_t q=db_hash_search(&hash,bf,nsz);
+
+      if(q>=items) $abort(bf);  //hash integrity broken
+      db_record_meta(&b,q,b.start_data+off,bsz);
+      db_rec_t x={.noff=noff,.nlen=nsz+1};
+      noff+=nsz+1;
+
+      if(c->dedup)
+      {
+        db_tmphash_t* r=0;
+        HASH_FIND(hh,root,&dhash,sizeof(dhash),r);
+        if(!r)
+        {
+          r=md_new(r);
+          r->h=dhash;
+          r->off=off;
+          r->len=bsz;
+          HASH_ADD_KEYPTR(hh,root,&r->h,sizeof(r->h),r);
+          x.len=bsz;
+          x.off=off;
+          off+=bsz;
+        }
+        else
+        {
+          x.len=r->len;
+          x.off=r->off;
+        }
+      }
+      else
+      {
+        x.len=bsz;
+        x.off=off;
+        off+=bsz;
+      }
+      db_build_record(&b,q,bf,nsz,&x);
+    }
+
+    while(root)
+    {
+      db_tmphash_t* l=root;
+      HASH_DELETE(hh,root,l);
+      md_free(l);
+    }
+  }
+
+  free(bf);
+  fclose(f);
+
+  db_part_finish(&b,off);
+  db_hash_free(&hash);
+
+  return 0;
+}
+
+//! return error string
+int db_build(const cfg_build_t* c)
+{
+  if(!c) $abort("no conig to build");
+  if(c->parts<1 || c->parts>UINT16_MAX) $abort("invalid number of parts");
+  if(c->fingerprint!=0 && c->fingerprint!=16 && c->fingerprint!=32) $abort("fingerprint must be 0, 16 or 32 bits");
+  if(c->index<DB_INDEX_COMPACT || c->index>DB_INDEX_WIDE) $abort("unknown index layout");
+  if(c->names<DB_NAMES_PLAIN || c->names>DB_NAMES_NONE) $abort("unknown names layout");
+  if(c->names==DB_NAMES_NONE && !c->fingerprint) $abort("names can be omitted only with fingerprint");
+
+  uint64_t t0=utils_time_abs();
+
+  db_build_task_t t={.cfg=c,.created=time(0),.build=db_build_part};
+  char uuid[37];
+  uuid_generate_random(t.uuid);
+  uuid_unparse_lower(t.uuid,uuid);
+  $msg("create database %s, source=%s, uuid=%s, parts=%d",c->db,c->src,uuid,c->parts);
+
+  t.stat=md_tcalloc(db_part_stat_t,c->parts);
+
+  mkdir(c->db,0770);
+  FILE* f=fopen(c->src,"r");
+  if(!f) $abort("no source");
+  char pathbuf[PATH_MAX+1];
+  size_t l=0;
+  char* bf=0;
+
+  while(getline(&bf,&l,f)>0)
+  {
+    db_part_stat_t* ps=t.stat+db_part_of(bf,strcspn(bf,"\t"),c->parts);
+    uint64_t names=ps->names;
+    uint64_t len=ps->headers+ps->bodies;
+    if(lineparse(bf,&ps->names,&ps->headers,&ps->bodies,c->etag,pathbuf))
+    {
+      $msg("can not parse line %s",bf);
+      $abort("input format error");
+    }
+    ps->items++;
+    names=ps->names-names;
+    len=ps->headers+ps->bodies-len;
+    if(names>ps->maxname) ps->maxname=names;
+    if(len>ps->maxlen) ps->maxlen=len;
+  }
+  free(bf);
+  fclose(f);
+
+  db_build_run(&t);
+  md_free(t.stat);
+
+  {
+    char *z=utils_time_format(t0);
+    $msg("build done, %s taken",z);
+    free(z);
+  }
+
+  return 0;
+}
+
+
+static const char* tile_header="Content-Length: %ld\r\nETag: mvt-%016lx\r\n\r\n";
+static const char* tile_url="/%ld/%ld/%ld.mvt";
+
+static sqlite3* db_tiles_open(const char* src)
+{
+  sqlite3 *db;
+
+  if(sqlite3_open_v2(src, &db,SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,0)!=SQLITE_OK) $abort("SQLite open error");
+
+  sqlite3_exec(db, "PRAGMA query_only=ON;", 0, 0, 0);
+  sqlite3_exec(db, "PRAGMA temp_store=MEMORY;", 0, 0, 0);
+  sqlite3_exec(db, "PRAGMA cache_size=-200000;", 0, 0, 0);   // ~200k страниц
+  sqlite3_exec(db, "PRAGMA mmap_size=1073741824;", 0, 0, 0); // 1 GiB
+  return db;
+}
+
+static int db_build_tiles_part(db_build_task_t* t,size_t part)
+{
+  const cfg_build_t* c=t->cfg;
+  const db_part_stat_t* ps=t->stat+part;
+  const size_t items=ps->items;
+  const size_t hsz=strlen(tile_header)-3-6+16;  // -%ld -%016lx + 16 hex hash
+
+  sqlite3* db=db_tiles_open(c->src);
+  sqlite3_stmt *stmt;
+
+  db_keys_t keys;
+  db_keys_init(&keys,items,ps->names);
+
+  {
+    char path[1024];
+    sqlite3_prepare_v2(db,"select zoom_level,tile_column,tile_row from tiles_shallow;",-1,&stmt,0);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
       uint64_t zoom=sqlite3_column_int(stmt,0);
       uint64_t col=sqlite3_column_int(stmt,1);
       uint64_t row=sqlite3_column_int(stmt,2);
 
-      int64_t y=(1ULL<<zoom)-1-row;
-      snprintf(path,sizeof(path)-1,url,zoom,col,y);
-//$msg("stage1: <%s>",path);
-      pidx[i++]=arena+n;
-      strcpy(arena+n,path);
-      n+=strlen(path)+1;
-    }
-    sqlite3_finalize(stmt);
+      int64_t y=(1ULL<<zoom)-1-row;
+      int nsz=snprintf(path,sizeof(path)-1,tile_url,zoom,col,y);
+      if(db_part_of(path,nsz,c->parts)!=part) continue;
+      db_keys_add(&keys,path,nsz);
+    }
+    sqlite3_finalize(stmt);
+  }
+  if(keys.n!=items) $abort("source changed during build");
+
+  db_hash_t hash;
+  mphf_key_t dup;
+  if(!db_hash_build(&hash,&keys,t->hash_threads,&dup))
+  {
+    db_dup_t d={dup,0};
+    char path[1024];
+    sqlite3_prepare_v2(db,"select zoom_level,tile_column,tile_row from tiles_shallow;",-1,&stmt,0);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      uint64_t zoom=sqlite3_column_int(stmt,0);
+      uint64_t col=sqlite3_column_int(stmt,1);
+      uint64_t row=sqlite3_column_int(stmt,2);
+      int nsz=snprintf(path,sizeof(path)-1,tile_url,zoom,col,(int64_t)((1ULL<<zoom)-1-row));
+      if(db_part_of(path,nsz,c->parts)==part) db_dup_check(&d,path,nsz);
+    }
+    $abort("hash generation failed, source changed during build");
+  }
+
+  db_part_build_t b;
+  db_part_create(&b,t,part,&hash);
+
+  size_t off=0;
+  size_t noff=0;
+  size_t next=0;
+
+  {
+    char path[1024];
+    char hx[hsz+512];
+    sqlite3_prepare_v2(db,
+      "select tiles_shallow.tile_data_id as id,tiles_shallow.zoom_level as zoom_level,tiles_shallow.tile_column as tile_column,tiles_shallow.tile_row as tile_row, tiles_data.tile_data as tile_data "
+      "from tiles_shallow join tiles_data on tiles_shallow.tile_data_id = tiles_data.tile_data_id order by id;",
+       -1, &stmt,0);
+
+    size_t last=0;
+
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      uint64_t id=sqlite3_column_int(stmt, 0);
+      uint64_t zoom=sqlite3_column_int(stmt, 1);
+      uint64_t col=sqlite3_column_int(stmt, 2);
+      uint64_t row=sqlite3_column_int(stmt, 3);
+
+      uint64_t nsz=snprintf(path,sizeof(path)-1,tile_url,zoom,col,(1ULL<<zoom)-1-row);
+      if(db_part_of(path,nsz,c->parts)!=part) continue;
+
+      size_t q=db_hash_search(&hash,path,nsz);
+      if(q>=items) $abort("name integrity");
+      db_rec_t x;
+
+      const void* bl=sqlite3_column_blob(stmt, 4);
+      size_t bz=sqlite3_column_bytes(stmt, 4);
+
+      uint64_t h=xx(bl,bz);
+      snprintf(hx,sizeof(hx)-1,tile_header,bz,h);
+
+      x.len=bz+strlen(hx);
+      x.off=off;
+
+      x.nlen=nsz+1;
+      x.noff=noff;
+
+      memcpy(b.start_names+noff,path,x.nlen);
+      noff+=x.nlen;
+
+      if(last!=id)
+      {
+        x.off=next;
+        void* t=mempcpy(b.start_data+x.off,hx,strlen(hx));
+        memcpy(t,bl,bz);
+        off=next;
+        next=x.off+x.len;
+      }
+      last=id;
+      db_record_meta(&b,q,b.start_data+x.off,x.len);
+      db_build_record(&b,q,path,nsz,&x);
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  db_part_finish(&b,next);
+
+  db_hash_free(&hash);
+  sqlite3_close(db);
+
+  return 0;
+}
+
+static int db_tile_cmp(const void* a,const void* b)
+{
+  uint64_t x=((const db_tile_entry_t*)a)->id;
+  uint64_t y=((const db_tile_entry_t*)b)->id;
+  return x<y ? -1 : x>y;
+}
+
+//! part of tile database with directory instead of hash and names
+static int db_build_tiles_dir_part(db_build_task_t* t,size_t part)
+{
+  const cfg_build_t* c=t->cfg;
+  const db_part_stat_t* ps=t->stat+part;
+  const size_t items=ps->items;
+  const uint64_t data=ps->headers+ps->bodies;
+
+  db_part_build_t b;
+  memset(&b,0,sizeof(b));
+  b.name_idx=md_sprintf("%s/idx.part%zu",c->db,part);
+  b.name_data=md_sprintf("%s/data.part%zu",c->db,part);
+  b.fdata=db_file_create(b.name_data,data);
+  b.start_data=b.fdata->payload;
+  db_header_init(&b.hdata,DB_MAGIC_DATA,t,part,items,data);
+
+  db_tile_entry_t* e=md_tmalloc(db_tile_entry_t,items ? items : 1);
+  size_t n=0;
+  size_t next=0;
+
+  sqlite3* db=db_tiles_open(c->src);
+  {
+    sqlite3_stmt *stmt;
+    char hx[strlen(tile_header)+512];
+    sqlite3_prepare_v2(db,
+      "select tiles_shallow.tile_data_id as id,tiles_shallow.zoom_level as zoom_level,tiles_shallow.tile_column as tile_column,tiles_shallow.tile_row as tile_row, tiles_data.tile_data as tile_data "
+      "from tiles_shallow join tiles_data on tiles_shallow.tile_data_id = tiles_data.tile_data_id order by id;",
+       -1, &stmt,0);
+
+    size_t last=0;
+    uint64_t off=0;
+    uint32_t len=0;
+
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      uint64_t id=sqlite3_column_int(stmt, 0);
+      uint64_t zoom=sqlite3_column_int(stmt, 1);
+      uint64_t col=sqlite3_column_int(stmt, 2);
+      uint64_t row=sqlite3_column_int(stmt, 3);
+
+      if(zoom>DB_TILE_MAXZOOM) $abort("zoom too deep for tile directory");
+      uint64_t tid=db_tile_id(zoom,col,(1ULL<<zoom)-1-row);
+      if(db_tile_part(tid,c->parts)!=part) continue;
+      if(n>=items) $abort("source changed during build");
+
+      if(last!=id)
+      {
+        const void* bl=sqlite3_column_blob(stmt, 4);
+        size_t bz=sqlite3_column_bytes(stmt, 4);
+        snprintf(hx,sizeof(hx)-1,tile_header,bz,xx(bl,bz));
+
+        off=next;
+        void* w=mempcpy(b.start_data+off,hx,strlen(hx));
+        w=mempcpy(w,bl,bz);
+        next=w-b.start_data;
+        len=next-off;
+      }
+      last=id;
+
+      e[n++]=(db_tile_entry_t){.id=tid,.off=off,.len=len,.run=1};
+    }
+    sqlite3_finalize(stmt);
+  }
+  sqlite3_close(db);
+  if(n!=items) $abort("source changed during build");
+
+// runs of equal tiles along the curve collapse into one entry
+  qsort(e,n,sizeof(*e),db_tile_cmp);
+  size_t m=0;
+  for(size_t i=0;i<n;i++)
+  {
+    db_tile_entry_t* r=e+m-1;
+    if(m && r->id+r->run==e[i].id && r->off==e[i].off && r->len==e[i].len && r->run<UINT32_MAX) r->run++;
+    else e[m++]=e[i];
+  }
+
+  db_header_init(&b.hidx,DB_MAGIC_INDEX,t,part,m,0);
+  b.hidx.rec_layout=DB_IDX_TILES;
+  b.hidx.rec_size=sizeof(db_tile_entry_t);
+  if(db_layout_init(&b.layout,&b.hidx)) $abort("index layout");
+  b.hidx.size=db_layout_size(&b.layout,m);
+  db_index_extra(&b.hidx,c->etag);
+  b.hdata.records=m;
+
+  b.fidx=db_file_create(b.name_idx,b.hidx.size);
+  memcpy(b.fidx->payload,e,m*sizeof(*e));
+  uint64_t* roots=b.fidx->payload+m*sizeof(*e);
+  for(size_t i=0;i<m;i+=DB_TILE_BLOCK) roots[i/DB_TILE_BLOCK]=e[i].id;
+  db_index_arrays(&b);
+  for(size_t i=0;i<m;i++) db_record_meta(&b,i,b.start_data+e[i].off,e[i].len);
+  md_free(e);
+
+  $msg("part %zu: %zu tiles in %zu directory entries",part,n,m);
+  db_part_finish(&b,next);
+  return 0;
+}
+
+//! return error string
+int db_build_tiles(const cfg_build_t* c)
+{
+  if(!c) $abort("no conig to build");
+  if(c->parts<1 || c->parts>UINT16_MAX) $abort("invalid number of parts");
+  if(c->fingerprint!=0 && c->fingerprint!=16 && c->fingerprint!=32) $abort("fingerprint must be 0, 16 or 32 bits");
+  if(c->index<DB_INDEX_COMPACT || c->index>DB_INDEX_WIDE) $abort("unknown index layout");
+  if(c->names<DB_NAMES_PLAIN || c->names>DB_NAMES_NONE) $abort("unknown names layout");
+  if(c->names==DB_NAMES_NONE && !c->fingerprint) $abort("names can be omitted only with fingerprint");
+
+  uint64_t t0=utils_time_abs();
+
+  db_build_task_t t={.cfg=c,.created=time(0),.build=c->tile_index ? db_build_tiles_dir_part : db_build_tiles_part,.sparse=c->tile_index};
+  char uuid[37];
+  uuid_generate_random(t.uuid);
+  uuid_unparse_lower(t.uuid,uuid);
+  $msg("create database %s, source=%s, uuid=%s, parts=%d",c->db,c->src,uuid,c->parts);
+
+  t.stat=md_tcalloc(db_part_stat_t,c->parts);
+  const size_t hsz=strlen(tile_header)-3-6+16;
+
+  sqlite3 *db=db_tiles_open(c->src);
+  mkdir(c->db,0770);
+
+// headers are Content-Length, ETag = "mvt-" + hex(hash).
+// sizes are collected per part, shared tile bodies are stored once in every part referencing them
+  {
+    char path[1024];
+    sqlite3_stmt *stmt;
+    size_t* last=md_tcalloc(size_t,c->parts);
+
+    sqlite3_prepare_v2(db,
+      "select tiles_shallow.tile_data_id as id,tiles_shallow.zoom_level,tiles_shallow.tile_column,tiles_shallow.tile_row,length(tiles_data.tile_data) "
+      "from tiles_shallow join tiles_data on tiles_shallow.tile_data_id = tiles_data.tile_data_id order by id;",
+       -1, &stmt,0);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      uint64_t id=sqlite3_column_int(stmt,0);
+      uint64_t zoom=sqlite3_column_int(stmt,1);
+      uint64_t col=sqlite3_column_int(stmt,2);
+      uint64_t row=sqlite3_column_int(stmt,3);
+      uint64_t bz=sqlite3_column_int64(stmt,4);
+
+      int nsz=snprintf(path,sizeof(path)-1,tile_url,zoom,col,(1ULL<<zoom)-1-row);
+      size_t p=c->tile_index ? db_tile_part(db_tile_id(zoom,col,(1ULL<<zoom)-1-row),c->parts) : db_part_of(path,nsz,c->parts);
+      db_part_stat_t* ps=t.stat+p;
+      uint64_t len=bz+hsz+snprintf(0,0,"%lu",bz);
+      ps->items++;
+      ps->names+=nsz+1;
+      if(nsz+1>ps->maxname) ps->maxname=nsz+1;
+      if(len>ps->maxlen) ps->maxlen=len;
+      if(last[p]!=id)
+      {
+        ps->bodies+=bz;
+        ps->headers+=len-bz;
+      }
+      last[p]=id;
+    }
+    sqlite3_finalize(stmt);
+    md_free(last);
+  }
+  sqlite3_close(db);
+
+  db_build_run(&t);
+  md_free(t.stat);
+
+  {
+    char *z=utils_time_format(t0);
+    $msg("build done, %s taken",z);
+    free(z);
+  }
+
+  return 0;
+}
+
+
+static int db_check(const db_file_t* df,const db_header_t* ref,uint32_t magic)
+{
+  if(!df) return -1;
+  db_header_t* h=df->data;
+  if(*(uint32_t*)df->data!=magic) return -1;
+  if(h->records!=ref->records || h->size+h->offset!=df->sz) return -1;
+  if(h->parts!=ref->parts || h->part!=ref->part) return -1;
+  if(magic==DB_MAGIC_INDEX)
+  {
+    db_layout_t l;
+    if(db_layout_init(&l,h)) return -1;
+    size_t sz=db_layout_size(&l,h->records);
+// entity tags and header lengths follow records, aligned
+    if(h->tags && h->tags!=((sz+7)&~7ULL)) return -1;
+    if(h->tags) sz=h->tags+h->records*sizeof(uint64_t);
+    if(h->heads && h->heads!=((sz+7)&~7ULL)) return -1;
+    if(h->heads) sz=h->heads+h->records*sizeof(uint32_t);
+    if(sz!=h->size) return -1;
+  }
+  if(memcmp(h->uuid,ref->uuid,sizeof(uuid_t))) return -1;
+
+  return 0;
+}
+
+static void* db_scrub_thread(void* arg)
+{
+  db_scrub_t* s=arg;
+  void* buf=0;
+  if(s->background)
+  {
+    setpriority(PRIO_PROCESS,gettid(),19);
+    unsigned bits=0;
+    for(size_t i=0;i<s->nfiles;i++) if(s->files[i]->chunk_bits>bits) bits=s->files[i]->chunk_bits;
+    buf=aligned_alloc(4096,1ULL<<bits);
+  }
+
+  size_t fi=0;
+  size_t base=0;
+  for(size_t c;!atomic_load_explicit(&s->stop,memory_order_relaxed) && (c=atomic_fetch_add(&s->next,1))<s->chunks;)
+  {
+    while(c>=base+s->files[fi]->chunks) base+=s->files[fi++]->chunks;
+    db_file_t* f=s->files[fi];
+    size_t i=c-base;
+    if(f->state && atomic_load_explicit(f->state+i,memory_order_relaxed)==DB_CHUNK_OK) continue;
+    if(db_chunk_verify(f,i,buf)) atomic_fetch_add(&s->bad,1);
+    if(c==s->chunks-1 && s->background) $msg("scrub reached end, %zu bad chunks",atomic_load(&s->bad));
+  }
+
+  free(buf);
+  return 0;
+}
+
+//! verify chunks of files, in background uses direct io to keep page cache
+static db_scrub_t* db_scrub_start(db_t* db,db_file_t** files,size_t n,size_t threads,int background)
+{
+  db_scrub_t* s=md_new(s);
+  s->db=db;
+  s->files=files;
+  s->nfiles=n;
+  s->threads=threads ? threads : 1;
+  s->background=background;
+  for(size_t i=0;i<n;i++)
+  {
+    s->chunks+=files[i]->chunks;
+    if(background && files[i]->dfd<0) files[i]->dfd=open(files[i]->name,O_RDONLY|O_DIRECT);
+  }
+
+  s->tp=md_tcalloc(pthread_t,s->threads);
+  for(size_t i=0;i<s->threads;i++)
+    if(pthread_create(s->tp+i,0,db_scrub_thread,s)) $abort("scrub start");
+  return s;
+}
+
+//! wait scrubber threads and free it, return number of bad chunks
+static size_t db_scrub_join(db_scrub_t* s)
+{
+  for(size_t i=0;i<s->threads;i++) pthread_join(s->tp[i],0);
+  size_t bad=s->bad;
+  md_free(s->tp);
+  md_free(s->files);
+  md_free(s);
+  return bad;
+}
+
+//! hot blocks are read ahead in order, last thread to finish reports
+static void* db_warm_thread(void* arg)
+{
+  db_warm_t* w=arg;
+  for(size_t i;!atomic_load_explicit(&w->stop,memory_order_relaxed) && (i=atomic_fetch_add(&w->next,1))<w->n;)
+  {
+    const db_file_t* f=w->db->parts[w->blocks[i].part].data;
+    size_t off=(size_t)w->blocks[i].block<<DB_HEAT_BITS;
+    size_t len=off+(1ULL<<DB_HEAT_BITS)>f->psz ? f->psz-off : 1ULL<<DB_HEAT_BITS;
+    readahead(f->fd,f->payload-f->data+off,len);
+  }
+  if(atomic_fetch_sub(&w->left,1)==1 && !atomic_load(&w->stop))
+  {
+    char* z=utils_time_format(w->t0);
+    $msg("warmup of %zu hot blocks submitted, %s taken",w->n,z);
+    free(z);
+  }
+  return 0;
+}
+
+static db_warm_t* db_warm_start(db_t* db,db_block_t* blocks,size_t n,size_t threads)
+{
+  db_warm_t* w=md_new(w);
+  w->db=db;
+  w->blocks=blocks;
+  w->n=n;
+  w->threads=threads ? threads : 1;
+  w->left=w->threads;
+  w->t0=utils_time_abs();
+  w->tp=md_tcalloc(pthread_t,w->threads);
+  for(size_t i=0;i<w->threads;i++)
+    if(pthread_create(w->tp+i,0,db_warm_thread,w)) $abort("warmup start");
+  return w;
+}
+
+static void db_warm_join(db_warm_t* w)
+{
+  for(size_t i=0;i<w->threads;i++) pthread_join(w->tp[i],0);
+  md_free(w->tp);
+  md_free(w->blocks);
+  md_free(w);
+}
+
+//! collect files of all parts, mask is bit set of 0 - index, 1 - data, 2 - names, 3 - hash
+static db_file_t** db_files(const db_t* db,db_file_t** extra,unsigned mask,size_t* n)
+{
+  db_file_t** rv=md_pcalloc(db->cnt*4);
+  *n=0;
+  for(size_t i=0;i<db->cnt;i++)
+  {
+    db_part_t* p=db->parts+i;
+    if(mask&1) rv[(*n)++]=p->index;
+    if(mask&2) rv[(*n)++]=p->data;
+    if(mask&4 && p->name) rv[(*n)++]=p->name;
+    if(mask&8 && extra[i]) rv[(*n)++]=extra[i];
+  }
+  return rv;
+}
+
+//! open one part, ref is header of part0 index; files go to p as they open, hash file to *hash
+static const char* db_part_open(db_part_t* p,const char* fn,size_t part,const db_header_t* ref,db_file_t** hash)
+{
+  char* name_hash=md_sprintf("%s/hash.part%zu",fn,part);
+  char* name_idx=md_sprintf("%s/idx.part%zu",fn,part);
+  char* name_data=md_sprintf("%s/data.part%zu",fn,part);
+  char* name_names=md_sprintf("%s/names.part%zu",fn,part);
+  const char* err=0;
+
+  db_file_t* didx=p->index=db_file_open(name_idx);
+  db_file_t* ddata=p->data=db_file_open(name_data);
+  if(!didx || !ddata)
+  {
+    err="open database error";
+    goto done;
+  }
+
+  db_header_t* dh=(db_header_t*)(didx->data);
+  if(memcmp(dh->uuid,ref->uuid,sizeof(uuid_t)) || dh->parts!=ref->parts || dh->part!=part) err="part does not belong to database";
+  else if(db_layout_init(&p->layout,dh)) err="unknown index record format";
+  else if((dh->rec_layout==DB_IDX_TILES)!=(ref->rec_layout==DB_IDX_TILES)) err="part does not belong to database";
+  if(err) goto done;
+
+  p->record_count=dh->records;
+  p->records=didx->payload;
+  p->strings=ddata->payload;
+  p->tags=dh->tags ? didx->payload+dh->tags : 0;
+  p->heads=dh->heads ? didx->payload+dh->heads : 0;
+
+  if(dh->rec_layout==DB_IDX_TILES)
+  {
+    if(db_check(didx,dh,DB_MAGIC_INDEX)) err="index file integrity check failed";
+    else if(db_check(ddata,dh,DB_MAGIC_DATA)) err="data file integrity check failed";
+    p->roots=p->records+p->record_count*sizeof(db_tile_entry_t);
+    p->nroots=(p->record_count+DB_TILE_BLOCK-1)/DB_TILE_BLOCK;
+    goto done;
+  }
+
+  db_file_t* dhash=*hash=db_file_open(name_hash);
+  db_file_t* dname=p->name=db_file_open(name_names);
+  if(!dhash || !dname)
+  {
+    err="open database error";
+    goto done;
+  }
+
+  const db_header_t* nh=dname->data;
+  if(nh->names_layout>DB_NAMES_NONE || (nh->names_layout==DB_NAMES_NONE && !dh->fp_bits)) err="unknown names format";
+  else if(db_check(didx,dh,DB_MAGIC_INDEX)) err="index file integrity check failed";
+  else if(db_check(ddata,dh,DB_MAGIC_DATA)) err="data file integrity check failed";
+  else if(db_check(dhash,dh,DB_MAGIC_HASH)) err="hash file integrity check failed";
+  else if(db_check(dname,dh,DB_MAGIC_NAMES)) err="names file integrity check failed";
+  if(err) goto done;
+
+  p->names=dname->payload;
+  p->names_layout=nh->names_layout;
+  if(p->names_layout==DB_NAMES_FRONT)
+  {
+    p->nblocks=(p->record_count+DB_NAMES_BLOCK-1)/DB_NAMES_BLOCK;
+    p->blocks=p->names;
+    p->names+=(p->nblocks+1)*sizeof(uint64_t);
+    if(nh->names_block!=DB_NAMES_BLOCK || (p->nblocks+1)*sizeof(uint64_t)>dname->psz || p->blocks[p->nblocks]+(p->nblocks+1)*sizeof(uint64_t)!=dname->psz)
+      err="names file integrity check failed";
+  }
+
+done:
+  md_free(name_hash);
+  md_free(name_idx);
+  md_free(name_data);
+  md_free(name_names);
+
+  return err;
+}
+
+//! hash file is owned by part after the call, error message or 0
+static const char* db_part_load_hash(db_part_t* p,db_file_t* dhash)
+{
+  if(!dhash) return 0;
+  const db_header_t* h=dhash->data;
+  if(h->hash_algo==DB_HASH_MPHF)
+  {
+// function is evaluated in place, file stays mapped
+    p->hfile=dhash;
+    p->hash.mphf=mphf_open(dhash->payload,dhash->psz);
+    if(!p->hash.mphf || mphf_count(p->hash.mphf)!=p->record_count) return "hash data integrity failed";
+    p->hash.seed=mphf_seed(p->hash.mphf);
+    return 0;
+  }
+  if(h->hash_algo==DB_HASH_CMPH_PACKED)
+  {
+    p->hash.packed=dhash->payload;
+    p->hfile=dhash;
+    return 0;
+  }
+  db_file_free(dhash);
+  return "unknown hash algorithm, rebuild database";
+}
+
+db_t* db_open(const char* fn,unsigned flags)
+{
+  db_header_t ref;
+  {
+    char* name_idx=md_sprintf("%s/idx.part0",fn);
+    int fd=open(name_idx,O_RDONLY);
+    memset(&ref,0,sizeof(ref));
+// first format has shorter header, its parts tell why they do not open
+    int ok=fd>=0 && pread(fd,&ref,sizeof(ref),0)>DB_HEADER0;
+    if(!ok) $msg("%s: open database error: %m",name_idx);
+    if(fd>=0) close(fd);
+    md_free(name_idx);
+    if(!ok) return 0;
+  }
+
+  char u[37];
+  uuid_unparse_lower(ref.uuid,u);
+$msg("try to open database %s, %hu parts",u,ref.parts);
+  if(!ref.parts)
+  {
+    $msg("%s: index file integrity check failed",fn);
+    return 0;
+  }
+
+  db_t* rv=md_new(rv);
+  rv->cnt=ref.parts;
+  rv->parts=md_anew(rv->parts,rv->cnt);
+  rv->flags=flags;
+  rv->tiles=ref.rec_layout==DB_IDX_TILES;
+  rv->page=sysconf(_SC_PAGESIZE);
+
+  db_file_t** hashes=md_pcalloc(rv->cnt);
+  const char* err=0;
+  size_t i=0;
+  for(;i<rv->cnt && !err;i++) err=db_part_open(rv->parts+i,fn,i,&ref,hashes+i);
+
+// index and hash are verified always, data and names on request
+  if(!err)
+  {
+    size_t n;
+    db_file_t** files=db_files(rv,hashes,flags&DB_VERIFY_FULL ? 15 : 9,&n);
+    if(db_scrub_join(db_scrub_start(rv,files,n,db_threads(),0))) err="database integrity check failed";
+  }
+
+// parts own hash files after load attempt
+  for(i=0;i<rv->cnt;i++)
+    if(err) db_file_free(hashes[i]);
+    else err=db_part_load_hash(rv->parts+i,hashes[i]);
+  md_free(hashes);
+  if(err)
+  {
+    $msg("%s: %s",fn,err);
+    db_close(rv);
+    return 0;
+  }
+
+  if(flags&DB_VERIFY_LAZY)
+    for(size_t i=0;i<rv->cnt;i++)
+    {
+      db_file_track(rv->parts[i].data);
+      if(rv->parts[i].name) db_file_track(rv->parts[i].name);
+    }
+
+  return rv;
+}
+
+size_t db_scrub(db_t* db,size_t threads,int wait)
+{
+  if(!db || db->scrub) return 0;
+
+  size_t n;
+  db_file_t** files=db_files(db,0,6,&n);
+  if(wait) return db_scrub_join(db_scrub_start(db,files,n,threads ? threads : db_threads(),1));
+
+  for(size_t i=0;i<n;i++) db_file_track(files[i]);
+  db->scrub=db_scrub_start(db,files,n,threads,1);
+  return 0;
+}
+
+
+void db_close(db_t* db)
+{
+  if(!db) return;
+
+  if(db->scrub)
+  {
+    atomic_store(&db->scrub->stop,1);
+    db_scrub_join(db->scrub);
+  }
+  if(db->warm)
+  {
+    atomic_store(&db->warm->stop,1);
+    db_warm_join(db->warm);
+  }
+
+  for(size_t i=0;i<db->cnt;i++)
+  {
+    db_part_t* p=db->parts+i;
+    db_file_free(p->index);
+    db_file_free(p->data);
+    if(p->name) db_file_free(p->name);
+    if(p->hfile) db_file_free(p->hfile);
+
+    db_hash_free(&p->hash);
+  }
+
+  md_free(db->parts);
+  md_free(db);
+}
+
+
+int db_is_tiles(const db_t* db)
+{
+  return db && db->tiles;
+}
+
+static inline const char* db_tile_num(const char* s,const char* e,uint64_t* v)
+{
+  const char* b=s;
+  uint64_t r=0;
+  while(s<e && *s>='0' && *s<='9' && s-b<10) r=r*10+(*s++-'0');
+  *v=r;
+  return s>b ? s : 0;
+}
+
+int db_tile_parse(const char* key,size_t klen,unsigned* z,uint64_t* x,uint64_t* y)
+{
+  const char* e=key+klen;
+  uint64_t zz;
+  if(klen<10 || *key!='/' || memcmp(e-4,".mvt",4)) return -1;
+  e-=4;
+  if(!(key=db_tile_num(key+1,e,&zz)) || key>=e || *key!='/') return -1;
+  if(!(key=db_tile_num(key+1,e,x)) || key>=e || *key!='/') return -1;
+  if(!(key=db_tile_num(key+1,e,y)) || key!=e) return -1;
+  if(zz>DB_TILE_MAXZOOM || *x>>zz || *y>>zz) return -1;
+  *z=zz;
+  return 0;
+}
+
+//! last run starting at or before id, sampled ids select block
+static inline const db_tile_entry_t* db_tile_find(const db_part_t* p,uint64_t id)
+{
+  const uint64_t* r=p->roots;
+  if(!p->nroots || r[0]>id) return 0;
+  size_t lo=0,hi=p->nroots;
+  while(hi-lo>1)
+  {
+    size_t m=(lo+hi)/2;
+    if(r[m]<=id) lo=m;
+    else hi=m;
+  }
+
+  const db_tile_entry_t* e=(const db_tile_entry_t*)p->records+lo*DB_TILE_BLOCK;
+  hi=p->record_count-lo*DB_TILE_BLOCK;
+  if(hi>DB_TILE_BLOCK) hi=DB_TILE_BLOCK;
+  lo=0;
+  while(hi-lo>1)
+  {
+    size_t m=(lo+hi)/2;
+    if(e[m].id<=id) lo=m;
+    else hi=m;
+  }
+  e+=lo;
+  return id-e->id<e->run ? e : 0;
+}
+
+//! file position of found value for sendfile
+static inline void db_value_set(const db_part_t* p,db_value_t* v,const void* data,size_t len)
+{
+  v->data=data;
+  v->len=len;
+  v->fd=p->data->fd;
+  v->off=data-p->data->data;
+  v->file=p->data;
+}
+
+static inline void db_value_clear(db_value_t* v)
+{
+  v->data=0;
+  v->len=0;
+  v->fd=-1;
+  v->off=0;
+  v->etag=0;
+  v->head=0;
+  v->file=0;
+}
+
+int db_get_tile_value(const db_t* db,unsigned z,uint64_t x,uint64_t y,db_value_t* v)
+{
+  db_value_clear(v);
+  if(!db || !db->tiles || z>DB_TILE_MAXZOOM || x>>z || y>>z) return -1;
+
+  uint64_t id=db_tile_id(z,x,y);
+  const db_part_t* p=db->parts+db_tile_part(id,db->cnt);
+  const db_tile_entry_t* e=db_tile_find(p,id);
+  if(!e) return -1;
+  if((db->flags&(DB_VERIFY_LAZY|DB_VERIFY_DEFER))==DB_VERIFY_LAZY && db_file_touch(p->data,e->off,e->len)) return -1;
+
+  db_value_set(p,v,p->strings+e->off,e->len);
+  size_t r=e-(const db_tile_entry_t*)p->records;
+  if(p->tags) v->etag=p->tags[r];
+  if(p->heads) v->head=p->heads[r];
+  return 0;
+}
+
+const void* db_get_tile(const db_t* db,unsigned z,uint64_t x,uint64_t y,size_t* retlen)
+{
+  db_value_t v;
+  if(!retlen || db_get_tile_value(db,z,x,y,&v)) return 0;
+  *retlen=v.len;
+  return v.data;
+}
+
+const void* db_get(const db_t* db,const char* key,size_t* retlen)
+{
+  if(!key) return 0;
+  return db_get2(db,key,strlen(key),retlen);
+}
+
+
+//! select part of key, h is key hash when needed
+static inline db_part_t* db_locate(const db_t* db,const char* key,size_t klen,uint64_t* h)
+{
+  db_part_t* p=db->parts;
+  *h=0;
+  if(db->cnt>1 || p->layout.fp_bits)
+  {
+    *h=db_key_hash(key,klen);
+    p+=db_hash_part(*h,db->cnt);
   }
+  return p;
+}
 
-  cmph_io_adapter_t *source=cmph_io_vector_adapter(pidx,items);
-  cmph_config_t *config = cmph_config_new(source);
-  cmph_config_set_algo(config,PHASH_ALGO);
+static inline const void* db_slot(const db_part_t* p,size_t r)
+{
+  return r<p->record_count ? db_record(p,r) : 0;
+}
 
-  cmph_t* hash = cmph_new(config);
-  cmph_config_destroy(config);
-  cmph_io_vector_adapter_destroy(source);
-  if(!hash) $abort("hash generation failed");
-
-// create result files
-  char* name_hash=md_sprintf("%s/hash.part0",c->db);
-  char* name_idx=md_sprintf("%s/idx.part0",c->db);
-  char* name_data=md_sprintf("%s/data.part0",c->db);
-  char* name_names=md_sprintf("%s/names.part0",c->db);
-
-  db_file_t* fidx=db_file_create(name_idx,items*sizeof(db_idx_record_t)+sizeof(db_header_t));
-  db_file_t* fdata=db_file_create(name_data,headers+bodies+sizeof(db_header_t));
-  db_file_t* fnames=db_file_create(name_names,names+sizeof(db_header_t));
-
-  void* start_data=fdata->data+sizeof(db_header_t);
-  void* start_names=fnames->data+sizeof(db_header_t);
-  db_idx_record_t* start_idx=fidx->data+sizeof(db_header_t);
-
-  db_header_t hidx={0,};
-  db_header_t hdata={0,};
-  db_header_t hhash={0,};
-  db_header_t hname={0,};
-  hidx.magic=DB_MAGIC_INDEX;
-  hdata.magic=DB_MAGIC_DATA;
-  hhash.magic=DB_MAGIC_HASH;
-  hname.magic=DB_MAGIC_NAMES;
-  hname.parts=hhash.parts=hidx.parts=hdata.parts=1;
-  hname.part=hhash.part=hidx.part=hdata.part=0;
-  hname.created=hhash.created=hidx.created=hdata.created=time(0);
-  hname.records=hhash.records=hidx.records=hdata.records=items;
-  hidx.size=items*sizeof(db_idx_record_t);
-  hdata.size=headers+bodies;
-  hname.size=names;
-
-  memcpy(hdata.uuid,&u,sizeof(u));
-  memcpy(hidx.uuid,&u,sizeof(u));
-  memcpy(hhash.uuid,&u,sizeof(u));
-  memcpy(hname.uuid,&u,sizeof(u));
-
-  {
-    size_t hl=0;
-    char* hd=0;
-    FILE* fhash=open_memstream(&hd,&hl);
-    cmph_dump(hash,fhash);
-    fclose(fhash);
-
-    hhash.size=hl;
-    hhash.hash=xx(hd,hl);
-
-    fhash=fopen(name_hash,"wb");
-    if(fwrite(&hhash,sizeof(hhash),1,fhash)!=1) $abort(name_hash);
-    if(fwrite(hd,hl,1,fhash)!=1) $abort(name_hash);
-    fclose(fhash);
-
-    free(hd);
-  }
-
-  md_free(pidx);
-  md_free(arena);
+//! select part and slot of key
+static inline const void* db_lookup(const db_t* db,const char* key,size_t klen,db_part_t** part,uint64_t* h)
+{
+  db_part_t* p=*part=db_locate(db,key,klen,h);
+  return db_slot(p,db_hash_search(&p->hash,key,klen));
+}
 
-  size_t off=0;
-  size_t noff=0;
+//! checks which do not touch names and data
+static inline int db_precheck(const db_part_t* p,const db_rec_t* t,size_t klen,uint64_t h)
+{
+  if(t->nlen!=klen+1) return -1;
+  if(p->layout.fp_bits && t->fp!=db_hash_fp(h,p->layout.fp_bits)) return -1;
+  return 0;
+}
+
+static inline int db_names_needed(const db_t* db,const db_part_t* p)
+{
+  return p->names_layout!=DB_NAMES_NONE && !(p->layout.fp_bits && db->flags&DB_TRUST_FINGERPRINT);
+}
+
+//! compare key with name of rank r, tracks common prefix of key and each decoded name of block
+static inline int db_names_front_cmp(const db_t* db,const db_part_t* p,uint64_t r,const char* key,size_t klen)
+{
+  const uint64_t* bl=p->blocks+r/DB_NAMES_BLOCK;
+  if(db->flags&DB_VERIFY_LAZY && db_file_touch(p->name,(const void*)bl-(const void*)p->blocks,2*sizeof(uint64_t))) return -1;
+  if(db->flags&DB_VERIFY_LAZY && db_file_touch(p->name,p->names-(const void*)p->blocks+bl[0],bl[1]-bl[0])) return -1;
+
+  const uint8_t* s=p->names+bl[0];
+  uint64_t len;
+  s=db_varint(s,&len);
+  size_t m=db_common(key,klen,(const char*)s,len);
+  s+=len;
 
+  for(size_t i=r%DB_NAMES_BLOCK;i;i--)
   {
-    char path[1024];
-    char hx[hsz+512];
-    sqlite3_prepare_v2(db,
-      "select tiles_shallow.tile_data_id as id,tiles_shallow.zoom_level as zoom_level,tiles_shallow.tile_column as tile_column,tiles_shallow.tile_row as tile_row, tiles_data.tile_data as tile_data "
-      "from tiles_shallow join tiles_data on tiles_shallow.tile_data_id = tiles_data.tile_data_id order by id;",
-       -1, &stmt,0);
+    uint64_t lcp,sl;
+    s=db_varint(s,&lcp);
+    s=db_varint(s,&sl);
+// name shares lcp with previous one, previous one shares m with key
+    if(lcp<=m) m=lcp+db_common(key+lcp,klen-lcp,(const char*)s,sl);
+    len=lcp+sl;
+    s+=sl;
+  }
+  return m==klen && len==klen ? 0 : -1;
+}
 
-    size_t last=0;
-    size_t next=0;
+static inline void db_names_prefetch(const db_part_t* p,uint64_t noff)
+{
+  if(p->names_layout==DB_NAMES_FRONT) __builtin_prefetch(p->blocks+noff/DB_NAMES_BLOCK);
+  else __builtin_prefetch(p->names+noff);
+}
 
-    while(sqlite3_step(stmt) != SQLITE_DONE)
+static inline const void* db_resolve(const db_t* db,const db_part_t* p,const db_rec_t* t,const char* key,size_t klen,size_t* retlen)
+{
+//$msg("request <%.*s> found <%s>",(int)klen,key,(char*)(p->names+t->noff));
+  if(db_names_needed(db,p))
+  {
+    if(p->names_layout==DB_NAMES_FRONT)
     {
-      uint64_t id=sqlite3_column_int(stmt, 0);
-      uint64_t zoom=sqlite3_column_int(stmt, 1);
-      uint64_t col=sqlite3_column_int(stmt, 2);
-      uint64_t row=sqlite3_column_int(stmt, 3);
-      const void* b=sqlite3_column_blob(stmt, 4);
-      size_t bz=sqlite3_column_bytes(stmt, 4);
+      if(db_names_front_cmp(db,p,t->noff,key,klen)) return 0;
+    }
+    else
+    {
+      if(db->flags&DB_VERIFY_LAZY && db_file_touch(p->name,t->noff,t->nlen)) return 0;
+      if(memcmp(p->names+t->noff,key,klen)) return 0;
+    }
+  }
+  if((db->flags&(DB_VERIFY_LAZY|DB_VERIFY_DEFER))==DB_VERIFY_LAZY && db_file_touch(p->data,t->off,t->len)) return 0;
+
+  *retlen=t->len;
+  return p->strings+t->off;
+}
 
-      snprintf(path,sizeof(path)-1,url,zoom,col,(1ULL<<zoom)-1-row);
+const void* db_get2(const db_t* db,const char* key,size_t klen,size_t* retlen)
+{
+  if(!db || !db->parts || !key || !*key || !klen || !retlen) return 0;
 
-      uint64_t nsz=strlen(path);
-      ssize_t q=cmph_search(hash,path,nsz);
-      if(q<0) $abort("name integrity");
+  if(db->tiles)
+  {
+    unsigned z;
+    uint64_t x,y;
+    return db_tile_parse(key,klen,&z,&x,&y) ? 0 : db_get_tile(db,z,x,y,retlen);
+  }
 
-      uint64_t h=xx(b,bz);
-      snprintf(hx,sizeof(hx)-1,header,bz,h);
+  db_part_t* p;
+  uint64_t h;
+  const void* t=db_lookup(db,key,klen,&p,&h);
+  if(!t) return 0;
 
-      start_idx[q].len=bz+strlen(hx);
-      start_idx[q].off=off;
+  db_rec_t x;
+  db_record_decode(&p->layout,t,&x);
+  if(db_precheck(p,&x,klen,h)) return 0;
 
-      start_idx[q].nlen=nsz+1;
-      start_idx[q].noff=noff;
+  return db_resolve(db,p,&x,key,klen,retlen);
+}
 
-      memcpy(start_names+noff,path,start_idx[q].nlen);
-      noff+=start_idx[q].nlen;
 
-      if(last!=id)
+size_t db_get_batch(const db_t* db,const char* const* keys,const size_t* lens,size_t n,db_value_t* out)
+{
+  if(!db || !db->parts || !out) return 0;
+
+  size_t found=0;
+  if(db->tiles)
+  {
+    for(size_t i=0;i<n;i++)
+    {
+      unsigned z;
+      uint64_t x,y;
+      db_value_clear(out+i);
+      if(keys[i] && !db_tile_parse(keys[i],lens[i],&z,&x,&y) && !db_get_tile_value(db,z,x,y,out+i)) found++;
+    }
+    return found;
+  }
+
+  for(size_t b=0;b<n;b+=DB_BATCH)
+  {
+    size_t m=n-b<DB_BATCH ? n-b : DB_BATCH;
+    const char* const* k=keys+b;
+    const size_t* l=lens+b;
+    db_value_t* o=out+b;
+    db_part_t* p[DB_BATCH];
+    uint64_t h[DB_BATCH];
+    mphf_key_t mk[DB_BATCH];
+    const void* t[DB_BATCH];
+    size_t r[DB_BATCH];
+    db_rec_t x[DB_BATCH];
+
+// hash all keys, fetch hash function data
+    for(size_t i=0;i<m;i++)
+    {
+      db_value_clear(o+i);
+      if(!k[i] || !l[i])
       {
-        start_idx[q].off=next;
-        void* t=mempcpy(start_data+start_idx[q].off,hx,strlen(hx));
-        memcpy(t,b,bz);
-        off=next;
-        next=start_idx[q].off+start_idx[q].len;
+        p[i]=0;
+        continue;
       }
-      last=id;
+      p[i]=db_locate(db,k[i],l[i],h+i);
+      if(!p[i]->hash.mphf) continue;
+      mk[i]=mphf_hash(k[i],l[i],p[i]->hash.seed);
+      mphf_prefetch(p[i]->hash.mphf,mk[i]);
     }
-    sqlite3_finalize(stmt);
-  }
 
-//  hidx.size=items*sizeof(db_idx_record_t);
-  hidx.hash=xx(fidx->data+sizeof(db_header_t),hidx.size);
-  memcpy(fidx->data,&hidx,sizeof(hidx));
-  hdata.hash=xx(fdata->data+sizeof(db_header_t),hdata.size);
-  memcpy(fdata->data,&hdata,sizeof(hdata));
-  hname.hash=xx(fnames->data+sizeof(db_header_t),names);
-  memcpy(fnames->data,&hname,sizeof(hname));
+// evaluate hash, fetch index records
+    for(size_t i=0;i<m;i++)
+    {
+      t[i]=0;
+      if(!p[i]) continue;
+      r[i]=p[i]->hash.mphf ? mphf_lookup(p[i]->hash.mphf,mk[i]) : db_hash_search(&p[i]->hash,k[i],l[i]);
+      t[i]=db_slot(p[i],r[i]);
+      if(!t[i]) continue;
+      __builtin_prefetch(t[i]);
+      __builtin_prefetch(t[i]+p[i]->layout.stride-1);
+      if(p[i]->tags) __builtin_prefetch(p[i]->tags+r[i]);
+      if(p[i]->heads) __builtin_prefetch(p[i]->heads+r[i]);
+    }
 
-  db_file_free(fidx);
-  db_file_free(fdata);
-  db_file_free(fnames);
+// cheap checks, fetch names and data
+    for(size_t i=0;i<m;i++)
+    {
+      if(!t[i]) continue;
+      db_record_decode(&p[i]->layout,t[i],x+i);
+      if(db_precheck(p[i],x+i,l[i],h[i]))
+      {
+        t[i]=0;
+        continue;
+      }
+      if(db_names_needed(db,p[i])) db_names_prefetch(p[i],x[i].noff);
+      __builtin_prefetch(p[i]->strings+x[i].off);
+    }
 
-  md_free(name_hash);
-  md_free(name_idx);
-  md_free(name_data);
-  md_free(name_names);
+    for(size_t i=0;i<m;i++)
+    {
+      size_t len;
+      const void* d=t[i] ? db_resolve(db,p[i],x+i,k[i],l[i],&len) : 0;
+      if(!d) continue;
+      db_value_set(p[i],o+i,d,len);
+      if(p[i]->tags) o[i].etag=p[i]->tags[r[i]];
+      if(p[i]->heads) o[i].head=p[i]->heads[r[i]];
+      found++;
+    }
+  }
 
-  cmph_destroy(hash);
-  sqlite3_close(db);
+  return found;
+}
 
+//! [b,e) lies in one range locked by db_resident
+static int db_locked(const db_file_t* f,uintptr_t b,uintptr_t e)
+{
+  size_t lo=0,hi=f->nlocked;
+  while(lo<hi)
   {
-    char *z=utils_time_format(t0);
-    $msg("build done, %s taken",z);
-    free(z);
+    size_t m=(lo+hi)/2;
+    if(f->locked[2*m]<=b) lo=m+1;
+    else hi=m;
   }
-
-  return 0;
+  return lo && f->locked[2*lo-1]>=e;
 }
 
-
-static int db_check(const db_file_t* df,const char* uuid,uint64_t records,uint32_t magic)
+//! payload ranges of window w of v as sorted begin and end pairs, chunk rounded where deferred check reads whole chunks, merged where they meet
+static size_t db_window_ranges(const db_t* db,const db_value_t* v,const db_window_t* w,size_t* r)
 {
-  if(!df) return -1;
-  db_header_t* h=df->data;
-  if(*(uint32_t*)df->data!=magic) return -1;
-  if(h->records!=records || h->size+sizeof(db_header_t)!=df->sz) return -1;
+  db_file_t* f=v->file;
+  size_t off=(const char*)v->data-(const char*)f->payload;
+  int chunks=(db->flags&(DB_VERIFY_LAZY|DB_VERIFY_DEFER))==(DB_VERIFY_LAZY|DB_VERIFY_DEFER) && f->state;
+  unsigned cb=f->chunk_bits;
+  size_t n=0;
+  for(size_t i=0;i<w->n;i++)
+  {
+    size_t b=off+w->r[2*i],e=off+w->r[2*i+1];
+    if(b>=e) continue;
+    if(chunks)
+    {
+      b=b>>cb<<cb;
+      e=((e-1)>>cb)+1<<cb;
+      if(e>f->psz) e=f->psz;
+    }
+// few ranges, insertion sort
+    size_t j=n++;
+    for(;j && r[2*j-2]>b;j--)
+    {
+      r[2*j]=r[2*j-2];
+      r[2*j+1]=r[2*j-1];
+    }
+    r[2*j]=b;
+    r[2*j+1]=e;
+  }
+  size_t m=0;
+  for(size_t i=1;i<n;i++)
+  {
+    if(r[2*i]<=r[2*m+1])
+    {
+      if(r[2*i+1]>r[2*m+1]) r[2*m+1]=r[2*i+1];
+      continue;
+    }
+    m++;
+    r[2*m]=r[2*i];
+    r[2*m+1]=r[2*i+1];
+  }
+  return n ? m+1 : 0;
+}
 
-  char u[37];
-  uuid_unparse_lower(h->uuid,u);
-  if(strcmp(uuid,u)) return -1;
+int db_value_resident(const db_t* db,const db_value_t* v,const db_window_t* w)
+{
+  db_file_t* f=v->file;
+  size_t r[2*DB_WINDOW];
+  if(!f) return 1;
+  size_t n=db_window_ranges(db,v,w,r);
+  if((db->flags&(DB_VERIFY_LAZY|DB_VERIFY_DEFER))==(DB_VERIFY_LAZY|DB_VERIFY_DEFER) && f->state)
+    for(size_t i=0;i<n;i++)
+      for(size_t c=r[2*i]>>f->chunk_bits,e=(r[2*i+1]-1)>>f->chunk_bits;c<=e;c++)
+        if(atomic_load_explicit(f->state+c,memory_order_relaxed)!=DB_CHUNK_OK) return 0;
+
+  uintptr_t ps=db->page;
+  unsigned char vec[DB_MINCORE];
+  for(size_t i=0;i<n;i++)
+  {
+    uintptr_t b=(uintptr_t)f->payload+r[2*i]&~(ps-1);
+    uintptr_t e=(uintptr_t)f->payload+r[2*i+1];
+    if(f->nlocked && db_locked(f,b,e)) continue;
+    while(b<e)
+    {
+      size_t m=(e-b+ps-1)/ps;
+      if(m>DB_MINCORE) m=DB_MINCORE;
+      if(mincore((void*)b,m*ps,vec)) return 1;
+      for(size_t j=0;j<m;j++) if(!(vec[j]&1)) return 0;
+      b+=m*ps;
+    }
+  }
+  return 1;
+}
 
+int db_value_load(const db_t* db,const db_value_t* v,const db_window_t* w)
+{
+  db_file_t* f=v->file;
+  size_t r[2*DB_WINDOW];
+  if(!f) return 0;
+  size_t n=db_window_ranges(db,v,w,r);
+  uintptr_t ps=db->page;
+  for(size_t i=0;i<n;i++)
+  {
+    if((db->flags&(DB_VERIFY_LAZY|DB_VERIFY_DEFER))==(DB_VERIFY_LAZY|DB_VERIFY_DEFER) && db_file_touch(f,r[2*i],r[2*i+1]-r[2*i])) return -1;
+    uintptr_t b=(uintptr_t)f->payload+r[2*i]&~(ps-1);
+    uintptr_t e=(uintptr_t)f->payload+r[2*i+1];
+// kernels before 5.14 fault pages in one by one
+    if(madvise((void*)b,e-b,MADV_POPULATE_READ))
+      for(;b<e;b+=ps) (void)*(volatile const char*)b;
+  }
   return 0;
 }
 
-db_t* db_open(const char* fn)
+//! page rounded address ranges of one file to keep in memory
+typedef struct db_pin_t
 {
-  char* name_hash=md_sprintf("%s/hash.part0",fn);
-  char* name_idx=md_sprintf("%s/idx.part0",fn);
-  char* name_data=md_sprintf("%s/data.part0",fn);
-  char* name_names=md_sprintf("%s/names.part0",fn);
-
-  db_file_t* didx=db_file_open(name_idx);
-  db_file_t* ddata=db_file_open(name_data);
-  db_file_t* dhash=db_file_open(name_hash);
-  db_file_t* dname=db_file_open(name_names);
-
-  if(!didx || !ddata || !dhash || !dname) $abort("open database error");
+  uintptr_t* r;			//!< begin and end pairs
+  size_t n;
+  size_t cap;
+  uintptr_t page;		//!< page size of database
+} db_pin_t;
 
-  db_header_t* dh=(db_header_t*)(didx->data);
+static void db_pin_add(db_pin_t* p,const void* a,size_t len)
+{
+  if(!len) return;
+  uintptr_t ps=p->page;
+  if(p->n==p->cap)
+  {
+    p->cap=p->cap ? 2*p->cap : 256;
+    p->r=md_realloc(p->r,p->cap*2*sizeof(uintptr_t));
+  }
+  p->r[2*p->n]=(uintptr_t)a&~(ps-1);
+  p->r[2*p->n+1]=((uintptr_t)a+len+ps-1)&~(ps-1);
+  p->n++;
+}
 
-  char u[37];
-  uuid_unparse_lower(dh->uuid,u);
-$msg("try to open database %s",u);
+static int db_pin_cmp(const void* a,const void* b)
+{
+  uintptr_t x=*(const uintptr_t*)a;
+  uintptr_t y=*(const uintptr_t*)b;
+  return x<y ? -1 : x>y;
+}
 
-  if(db_check(didx,u,dh->records,DB_MAGIC_INDEX)) $abort("index file integrity check failed");
-  if(db_check(ddata,u,dh->records,DB_MAGIC_DATA)) $abort("data file integrity check failed");
-  if(db_check(dhash,u,dh->records,DB_MAGIC_HASH)) $abort("hash file integrity check failed");
-  if(db_check(dname,u,dh->records,DB_MAGIC_NAMES)) $abort("names file integrity check failed");
+//! overlapping and adjacent ranges are merged, refused mlock turns mode into willneed for the rest
+static size_t db_pin_apply(const db_file_t* f,db_pin_t* p,int* mode)
+{
+  size_t bytes=0;
+  if(*mode==DB_RESIDENT_NONE || !p->n) return 0;
+  qsort(p->r,p->n,2*sizeof(uintptr_t),db_pin_cmp);
+  size_t m=0;
+  for(size_t i=1;i<p->n;i++)
+  {
+    if(p->r[2*i]<=p->r[2*m+1])
+    {
+      if(p->r[2*i+1]>p->r[2*m+1]) p->r[2*m+1]=p->r[2*i+1];
+      continue;
+    }
+    m++;
+    p->r[2*m]=p->r[2*i];
+    p->r[2*m+1]=p->r[2*i+1];
+  }
+  p->n=m+1;
 
-  db_t* rv=md_new(rv);
-  rv->cnt=1;
-  rv->parts=md_new(rv->parts);
-  db_part_t* p=rv->parts;
+  for(size_t i=0;i<p->n;i++)
+  {
+    void* a=(void*)p->r[2*i];
+    size_t l=p->r[2*i+1]-p->r[2*i];
+    if(*mode==DB_RESIDENT_LOCK && mlock(a,l))
+    {
+      $msg("%s: mlock refused, falls back to willneed, raise RLIMIT_MEMLOCK or grant CAP_IPC_LOCK",f->name);
+      *mode=DB_RESIDENT_WILLNEED;
+    }
+    if(*mode==DB_RESIDENT_WILLNEED) madvise(a,l,MADV_WILLNEED);
+    bytes+=l;
+  }
+  return bytes;
+}
 
-  p->index=didx;
-  p->data=ddata;
-  p->name=dname;
-  p->record_count=dh->records;
-  p->records=didx->data+sizeof(db_header_t);
-  p->strings=ddata->data+sizeof(db_header_t);
-  p->names=dname->data+sizeof(db_header_t);
+static size_t db_pin_file(const db_t* db,const db_file_t* f,int* mode)
+{
+  db_pin_t p={.page=db->page};
+  db_pin_add(&p,f->data,f->sz);
+  size_t bytes=db_pin_apply(f,&p,mode);
+  md_free(p.r);
+  return bytes;
+}
 
+//! value of key goes to pins of its part, names are checked as on lookup
+static int db_pin_key(const db_t* db,db_pin_t* pins,const char* key,size_t klen)
+{
+  if(db->tiles)
   {
-    FILE* ft=fopen(name_hash,"r");
-    fseek(ft,sizeof(db_header_t),SEEK_SET);
-    p->hash=cmph_load(ft);
-    fclose(ft);
+    unsigned z;
+    uint64_t x,y;
+    if(db_tile_parse(key,klen,&z,&x,&y)) return -1;
+    uint64_t id=db_tile_id(z,x,y);
+    size_t i=db_tile_part(id,db->cnt);
+    const db_tile_entry_t* e=db_tile_find(db->parts+i,id);
+    if(!e) return -1;
+    db_pin_add(pins+i,db->parts[i].strings+e->off,e->len);
+    return 0;
   }
 
-  if(!p->hash) $abort("hash data integrity failed");
-  db_file_free(dhash);
+  db_part_t* p;
+  uint64_t h;
+  size_t len;
+  const void* t=db_lookup(db,key,klen,&p,&h);
+  if(!t) return -1;
+  db_rec_t x;
+  db_record_decode(&p->layout,t,&x);
+  if(db_precheck(p,&x,klen,h) || !db_resolve(db,p,&x,key,klen,&len)) return -1;
+  db_pin_add(pins+(p-db->parts),p->strings+x.off,x.len);
+  return 0;
+}
 
-  md_free(name_hash);
-  md_free(name_idx);
-  md_free(name_data);
-  md_free(name_names);
+//! tiles up to zoom, tile ids are ordered by zoom first so they lead every directory, hashed tiles are enumerated up to DB_PIN_HASH_ZOOM
+static size_t db_pin_zoom(const db_t* db,db_pin_t* pins,unsigned zoom)
+{
+  size_t n=0;
+  if(db->tiles)
+  {
+    uint64_t end=((1ULL<<2*(zoom+1))-1)/3;
+    for(size_t i=0;i<db->cnt;i++)
+    {
+      const db_part_t* p=db->parts+i;
+      const db_tile_entry_t* e=p->records;
+      for(size_t r=0;r<p->record_count && e[r].id<end;r++,n++) db_pin_add(pins+i,p->strings+e[r].off,e[r].len);
+    }
+    return n;
+  }
 
-  return rv;
+// lookups grow 4x per zoom, deeper levels of key database belong to resident_keys
+  if(zoom>DB_PIN_HASH_ZOOM)
+  {
+$msg("resident zoom %u is limited to %u for hashed database, list deeper tiles in resident keys",zoom,DB_PIN_HASH_ZOOM);
+    zoom=DB_PIN_HASH_ZOOM;
+  }
+  char key[64];
+  for(uint64_t z=0;z<=zoom;z++)
+    for(uint64_t x=0;x<1ULL<<z;x++)
+      for(uint64_t y=0;y<1ULL<<z;y++)
+        n+=!db_pin_key(db,pins,key,snprintf(key,sizeof(key),tile_url,z,x,y));
+  return n;
 }
 
-
-void db_close(db_t* db)
+//! one key per line, empty lines and lines starting with # are skipped
+static size_t db_pin_list(const db_t* db,db_pin_t* pins,const char* fn)
 {
-  if(!db) return;
+  FILE* f=fopen(fn,"r");
+  if(!f)
+  {
+    $msg("%s: resident key list not readable",fn);
+    return 0;
+  }
+  char* bf=0;
+  size_t l=0,n=0,miss=0;
+  ssize_t k;
+  while((k=getline(&bf,&l,f))>0)
+  {
+    while(k && (bf[k-1]=='\n' || bf[k-1]=='\r')) k--;
+    if(!k || *bf=='#') continue;
+    if(db_pin_key(db,pins,bf,k)) miss++;
+    else n++;
+  }
+  free(bf);
+  fclose(f);
+  if(miss) $msg("%s: %zu resident keys not in database",fn,miss);
+  return n;
+}
 
-  db_file_free(db->parts->index);
-  db_file_free(db->parts->data);
-  db_file_free(db->parts->name);
+size_t db_resident(const db_t* db,const cfg_server_t* c)
+{
+  if(!db || !c) return 0;
+  int index=c->resident_index;
+  int names=c->resident_names;
+  int data=c->resident_data;
+  size_t bytes=0;
 
-  cmph_destroy(db->parts->hash);
+  for(size_t i=0;i<db->cnt;i++)
+  {
+    const db_part_t* p=db->parts+i;
+    bytes+=db_pin_file(db,p->index,&index);
+    if(p->hfile) bytes+=db_pin_file(db,p->hfile,&index);
+    if(p->name) bytes+=db_pin_file(db,p->name,&names);
+  }
 
-  md_free(db->parts);
-  md_free(db);
+  if(data!=DB_RESIDENT_NONE && (c->resident_zoom>=0 || c->resident_keys))
+  {
+    db_pin_t* pins=md_tcalloc(db_pin_t,db->cnt);
+    for(size_t i=0;i<db->cnt;i++) pins[i].page=db->page;
+    size_t n=0;
+    if(c->resident_zoom>=0) n+=db_pin_zoom(db,pins,c->resident_zoom>DB_TILE_MAXZOOM ? DB_TILE_MAXZOOM : c->resident_zoom);
+    if(c->resident_keys) n+=db_pin_list(db,pins,c->resident_keys);
+    for(size_t i=0;i<db->cnt;i++)
+    {
+      db_file_t* f=db->parts[i].data;
+      bytes+=db_pin_apply(f,pins+i,&data);
+// values in locked ranges are resident without asking mincore, not after fallback to willneed
+      if(data==DB_RESIDENT_LOCK && pins[i].n)
+      {
+        f->locked=pins[i].r;
+        f->nlocked=pins[i].n;
+      }
+      else md_free(pins[i].r);
+    }
+    md_free(pins);
+$msg("%zu values pinned",n);
+  }
+  if(bytes) $msg("%zu MB of database made resident",bytes>>20);
+  return bytes;
 }
 
+//! heat map file, per part uint64_t number of blocks and counter per block follow
+typedef struct db_heat_header_t
+{
+  uint32_t magic;
+  uuid_t uuid;
+  uint16_t parts;
+  uint8_t bits;
+  uint8_t reserved;
+  uint64_t saved;
+} __attribute__((packed)) db_heat_header_t;
 
-const void* db_get(const db_t* db,const char* key,size_t* retlen)
+static const uint8_t* db_uuid(const db_t* db)
 {
-  if(!db || !db->parts || !key || !*key || !retlen) return 0;
+  return ((const db_header_t*)db->parts[0].index->data)->uuid;
+}
 
-  db_part_t* p=db->parts;
+static int db_heat_read(db_t* db,FILE* in)
+{
+  db_heat_header_t h;
+  if(fread(&h,sizeof(h),1,in)!=1 || h.magic!=DB_MAGIC_HEAT || h.bits!=DB_HEAT_BITS || h.parts!=db->cnt || memcmp(h.uuid,db_uuid(db),sizeof(uuid_t))) return -1;
+  for(size_t i=0;i<db->cnt;i++)
+  {
+    db_file_t* f=db->parts[i].data;
+    uint64_t n;
+    if(fread(&n,sizeof(n),1,in)!=1 || n!=f->blocks || fread((void*)f->heat,1,n,in)!=n) return -1;
+  }
+  return 0;
+}
+
+size_t db_heat_open(db_t* db,const char* fn,unsigned sample)
+{
+  if(!db || !sample || db->heat_sample) return 0;
+  for(size_t i=0;i<db->cnt;i++)
+  {
+    db_file_t* f=db->parts[i].data;
+    f->blocks=f->psz ? ((f->psz-1)>>DB_HEAT_BITS)+1 : 0;
+    f->heat=md_calloc(f->blocks ? f->blocks : 1);
+  }
+  db->heat_sample=sample;
 
-  ssize_t r=cmph_search(p->hash,key,strlen(key));
-  if(r<0 || r>=p->record_count) return 0;
-  const db_idx_record_t* t=p->records+r;
-  if(strcmp(p->names+t->noff,key)) return 0;
+  FILE* in=fn ? fopen(fn,"r") : 0;
+  if(!in) return 0;
+  int bad=db_heat_read(db,in);
+  fclose(in);
+  if(bad)
+  {
+    $msg("%s: heat map of other database or broken, starts cold",fn);
+    for(size_t i=0;i<db->cnt;i++) memset((void*)db->parts[i].data->heat,0,db->parts[i].data->blocks);
+    return 0;
+  }
 
-  *retlen=t->len;
-  return p->strings+t->off;
+  size_t hot=0;
+  for(size_t i=0;i<db->cnt;i++)
+  {
+    const db_file_t* f=db->parts[i].data;
+    for(size_t b=0;b<f->blocks;b++) hot+=f->heat[b]!=0;
+  }
+  return hot;
 }
 
-
-const void* db_get2(const db_t* db,const char* key,size_t klen,size_t* retlen)
+int db_heat_save(const db_t* db,const char* fn)
 {
-  if(!db || !db->parts || !key || !*key || !klen || !retlen) return 0;
-  db_part_t* p=db->parts;
-
-  ssize_t r=cmph_search(p->hash,key,klen);
-  if(r<0 || r>=p->record_count) return 0;
-  const db_idx_record_t* t=p->records+r;
+  if(!db || !db->heat_sample || !fn) return -1;
+// instance taking over listeners saves at the same time
+  char* tmp=md_sprintf("%s.%d",fn,getpid());
+  FILE* o=fopen(tmp,"w");
+  if(!o)
+  {
+    $msg("%s: open heat map error: %m",tmp);
+    md_free(tmp);
+    return -1;
+  }
 
-//$msg("request <%.*s> found <%s>",(int)klen,key,(char*)(p->names+t->noff));
-//$msg("%d %zd | %d",t->nlen,klen,t->len);
-  if(t->nlen!=klen+1 || memcmp(p->names+t->noff,key,klen)) return 0;
+  db_heat_header_t h={.magic=DB_MAGIC_HEAT,.parts=db->cnt,.bits=DB_HEAT_BITS,.saved=time(0)};
+  memcpy(h.uuid,db_uuid(db),sizeof(uuid_t));
+  fwrite(&h,sizeof(h),1,o);
+  uint8_t buf[4096];
+  for(size_t i=0;i<db->cnt;i++)
+  {
+    db_file_t* f=db->parts[i].data;
+    uint64_t n=f->blocks;
+    fwrite(&n,sizeof(n),1,o);
+// counters halve once one saturates, order of hot blocks stays and blocks nobody asks for any more cool down
+    int aging=atomic_exchange(&f->aging,0);
+    for(size_t b=0;b<n;b+=sizeof(buf))
+    {
+      size_t k=n-b<sizeof(buf) ? n-b : sizeof(buf);
+      for(size_t j=0;j<k;j++)
+      {
+        buf[j]=atomic_load_explicit(f->heat+b+j,memory_order_relaxed);
+        if(aging && buf[j]) atomic_store_explicit(f->heat+b+j,buf[j]/2,memory_order_relaxed);
+      }
+      fwrite(buf,1,k,o);
+    }
+  }
+  int rv=ferror(o) | fflush(o) | fsync(fileno(o));
+  rv|=fclose(o);
+  if(!rv) rv=rename(tmp,fn);
+  if(rv)
+  {
+    $msg("%s: save heat map error: %m",fn);
+    unlink(tmp);
+  }
+  md_free(tmp);
+  return rv ? -1 : 0;
+}
 
-  *retlen=t->len;
-  return p->strings+t->off;
+void db_heat(const db_t* db,uint32_t* tick,const db_value_t* v,size_t n)
+{
+  if(!db || !db->heat_sample) return;
+  for(size_t i=0;i<n;i++)
+  {
+    db_file_t* f=v[i].file;
+    if(!f || !f->heat || !v[i].data || !v[i].len || ++*tick<db->heat_sample) continue;
+    *tick=0;
+// racing workers may lose a hit, counters are samples anyway
+    size_t off=(const char*)v[i].data-(const char*)f->payload;
+    for(size_t b=off>>DB_HEAT_BITS,e=(off+v[i].len-1)>>DB_HEAT_BITS;b<=e;b++)
+    {
+      uint8_t x=atomic_load_explicit(f->heat+b,memory_order_relaxed);
+      if(x==UINT8_MAX) continue;
+      atomic_store_explicit(f->heat+b,x+1,memory_order_relaxed);
+      if(x+1==UINT8_MAX) atomic_store_explicit(&f->aging,1,memory_order_relaxed);
+    }
+  }
 }
 
+size_t db_warmup(db_t* db,size_t threads,int wait)
+{
+  if(!db || !db->heat_sample || db->warm) return 0;
+
+// counting sort by heat, hottest first
+  size_t pos[UINT8_MAX+1]={0,};
+  for(size_t i=0;i<db->cnt;i++)
+  {
+    const db_file_t* f=db->parts[i].data;
+    for(size_t b=0;b<f->blocks;b++) pos[f->heat[b]]++;
+  }
+  size_t n=0;
+  for(size_t x=UINT8_MAX;x;x--)
+  {
+    size_t k=pos[x];
+    pos[x]=n;
+    n+=k;
+  }
+  if(!n) return 0;
 
+  db_block_t* bl=md_tmalloc(db_block_t,n);
+  for(size_t i=0;i<db->cnt;i++)
+  {
+    const db_file_t* f=db->parts[i].data;
+    for(size_t b=0;b<f->blocks;b++)
+      if(f->heat[b]) bl[pos[f->heat[b]]++]=(db_block_t){i,b};
+  }
 
+  db_warm_t* w=db_warm_start(db,bl,n,threads);
+  if(wait) db_warm_join(w);
+  else db->warm=w;
+  return n<<DB_HEAT_BITS;
+}
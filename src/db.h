@@ -1,15 +1,83 @@
 
 typedef struct db_t db_t;
 
+typedef struct db_value_t
+{
+  const void* data;
+  size_t len;
+  int fd;		//!< data file holding value, -1 if not found
+  uint64_t off;		//!< value position in fd
+  uint64_t etag;	//!< db_etag of stored entity tag, 0 if database has none
+  size_t head;		//!< length of stored headers with empty line, body follows, 0 if unknown
+  void* file;		//!< data file of value for db_value_resident and db_value_load
+} db_value_t;
+
+#define DB_WINDOW	9	//!< ranges of db_window_t, stored headers and body ranges of one response
+
+//! bytes of value a response reads, begin and end pairs from value start in any order
+typedef struct db_window_t
+{
+  size_t n;
+  size_t r[2*DB_WINDOW];
+} db_window_t;
+
 struct cfg_build_t;
 struct cfg_server_t;
 
 int db_build(const struct cfg_build_t*);
 int db_build_tiles(const struct cfg_build_t*);
 
-db_t* db_open(const char* folder);
+#define DB_INDEX_COMPACT	0	//!< index fields packed to widths of actual data
+#define DB_INDEX_ALIGNED	1	//!< compact with power of two record size, records do not cross cache lines
+#define DB_INDEX_WIDE		2	//!< fixed db_idx_record_t of config.h
+
+#define DB_NAMES_PLAIN		0	//!< keys in slot order, NUL terminated
+#define DB_NAMES_FRONT		1	//!< sorted keys front coded in blocks, record refers to rank
+#define DB_NAMES_NONE		2	//!< no keys, fingerprint is the only verification
+
+#define DB_VERIFY_LAZY		1u	//!< verify data and names chunks on first access
+#define DB_VERIFY_FULL		2u	//!< verify all files before open returns
+#define DB_TRUST_FINGERPRINT	4u	//!< accept key on fingerprint match, names are not read
+#define DB_VERIFY_DEFER		8u	//!< lazy check of values is left to db_value_load, lookups do not read data
+
+#define DB_RESIDENT_NONE	0	//!< page cache decides
+#define DB_RESIDENT_WILLNEED	1	//!< read ahead once, pages may be evicted later
+#define DB_RESIDENT_LOCK	2	//!< mlock, pages stay until database is closed
+
+//! 0 if database does not open or fails its checks, reason is logged
+db_t* db_open(const char* folder,unsigned flags);
 void db_close(db_t*);
 
+//! applies resident_* policies of server config, index, hash and names files whole, data by tile zoom and key list, returns bytes kept
+size_t db_resident(const db_t* db,const struct cfg_server_t* c);
+
+//! verify data and names in threads, wait returns number of bad chunks, otherwise runs in background until db_close
+size_t db_scrub(db_t* db,size_t threads,int wait);
+
 const void* db_get(const db_t* db,const char* key,size_t* retlen);
 const void* db_get2(const db_t* db,const char* key,size_t klen,size_t* retlen);
+//! tile databases are keyed by /z/x/y.mvt and have no hash and names
+int db_is_tiles(const db_t* db);
+//! parse /z/x/y.mvt, returns 0 on success
+int db_tile_parse(const char* key,size_t klen,unsigned* z,uint64_t* x,uint64_t* y);
+const void* db_get_tile(const db_t* db,unsigned z,uint64_t x,uint64_t y,size_t* retlen);
+int db_get_tile_value(const db_t* db,unsigned z,uint64_t x,uint64_t y,db_value_t* v);
+//! hash of entity tag value as stored in index, weak prefix W/ excluded
+uint64_t db_etag(const char* tag,size_t len);
+//! lookup of n keys with interleaved memory access, missed keys get zero data, returns number of found keys
+size_t db_get_batch(const db_t* db,const char* const* keys,const size_t* lens,size_t n,db_value_t* out);
+
+//! counters of data blocks, one of sample found values is counted, map saved by previous run is loaded if it belongs to database, returns hot blocks loaded
+size_t db_heat_open(db_t* db,const char* fn,unsigned sample);
+//! replaces fn with heat map, counters of part halve after one of them saturated so blocks not asked for any more cool down
+int db_heat_save(const db_t* db,const char* fn);
+//! counts n values of lookup, tick is sampling state of caller
+void db_heat(const db_t* db,uint32_t* tick,const db_value_t* v,size_t n);
+//! reads blocks with heat ahead in threads, hottest first, waits for submission or runs in background until db_close, returns bytes
+size_t db_warmup(db_t* db,size_t threads,int wait);
+
+//! window w of v is in page cache and verified if deferred, reading it does not block
+int db_value_resident(const db_t* db,const db_value_t* v,const db_window_t* w);
+//! pages in window w of v and verifies it if deferred, blocks on disk, -1 if chunk is bad
+int db_value_load(const db_t* db,const db_value_t* v,const db_window_t* w);
 
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "http.h"
+
+//! first byte of [p,e) equal to a, b or c, e if none
+static inline const char* scan3(const char* p,const char* e,char a,char b,char c)
+{
+#if defined(__AVX2__)
+  const __m256i va=_mm256_set1_epi8(a),vb=_mm256_set1_epi8(b),vc=_mm256_set1_epi8(c);
+  for(;p+32<=e;p+=32)
+  {
+    __m256i x=_mm256_loadu_si256((const __m256i*)p);
+    uint32_t m=_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x,va),_mm256_cmpeq_epi8(x,vb)),_mm256_cmpeq_epi8(x,vc)));
+    if(m) return p+__builtin_ctz(m);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i sa=_mm_set1_epi8(a),sb=_mm_set1_epi8(b),sc=_mm_set1_epi8(c);
+  for(;p+16<=e;p+=16)
+  {
+    __m128i x=_mm_loadu_si128((const __m128i*)p);
+    uint32_t m=_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x,sa),_mm_cmpeq_epi8(x,sb)),_mm_cmpeq_epi8(x,sc)));
+    if(m) return p+__builtin_ctz(m);
+  }
+#endif
+  for(;p<e;p++)
+    if(*p==a || *p==b || *p==c) return p;
+  return e;
+}
+
+static inline const char* scan1(const char* p,const char* e,char a)
+{
+  return scan3(p,e,a,a,a);
+}
+
+size_t http_end(const char* b,size_t len,size_t from)
+{
+  const char* e=b+len;
+  const char* p=b+(from>3 ? from-3 : 0);
+  for(;;)
+  {
+    p=scan1(p,e,'\n');
+    if(p==e) return 0;
+    if(p-b>=3 && p[-1]=='\r' && p[-2]=='\n' && p[-3]=='\r') return p+1-b;
+    p++;
+  }
+}
+
+static inline int hex(char c)
+{
+  if(c>='0' && c<='9') return c-'0';
+  c|=0x20;
+  if(c>='a' && c<='f') return c-'a'+10;
+  return -1;
+}
+
+//! in place, malformed escapes are kept
+static size_t decode(char* s,size_t len)
+{
+  char* e=s+len;
+  char* p=(char*)scan1(s,e,'%');
+  char* o=p;
+  while(p<e)
+  {
+    int h,l;
+    if(*p=='%' && e-p>=3 && (h=hex(p[1]))>=0 && (l=hex(p[2]))>=0)
+    {
+      *o++=h<<4|l;
+      p+=3;
+    }
+    else *o++=*p++;
+  }
+  return o-s;
+}
+
+//! value of header line without optional white space
+static const char* value(const char* p,const char* e,size_t* len)
+{
+  while(p<e && (*p==' ' || *p=='\t')) p++;
+  while(e>p && (e[-1]==' ' || e[-1]=='\t')) e--;
+  *len=e-p;
+  return p;
+}
+
+//! comma separated list contains token
+static int token(const char* p,const char* e,const char* t,size_t tl)
+{
+  while(p<e)
+  {
+    const char* q=scan1(p,e,',');
+    size_t l;
+    const char* v=value(p,q,&l);
+    if(l==tl && !strncasecmp(v,t,tl)) return 1;
+    p=q+1;
+  }
+  return 0;
+}
+
+const char* http_etag(const char** p,const char* e,size_t* len)
+{
+  const char* s=*p;
+  while(s<e && (*s==' ' || *s=='\t' || *s==',')) s++;
+  if(s==e) return 0;
+  const char* t=s;
+  if(e-s>=2 && s[0]=='W' && s[1]=='/') s+=2;
+// opaque tag may contain commas
+  if(s<e && *s=='"')
+  {
+    const char* q=memchr(s+1,'"',e-s-1);
+    s=q ? q+1 : e;
+  }
+  else s=scan3(s,e,',',' ','\t');
+  *len=s-t;
+  *p=s;
+  return t;
+}
+
+//! decimal number, 0 if there is none or it overflows
+static const char* number(const char* p,const char* e,uint64_t* v)
+{
+  const char* s=p;
+  for(*v=0;p<e && *p>='0' && *p<='9' && p-s<19;p++) *v=*v*10+(*p-'0');
+  return p>s && (p==e || *p<'0' || *p>'9') ? p : 0;
+}
+
+int http_range(const char* s,size_t len,uint64_t size,http_range_t* r,size_t max)
+{
+  const char* e=s+len;
+  if(len<6 || strncasecmp(s,"bytes=",6)) return -1;
+  int n=0;
+  size_t specs=0;
+  for(const char* p=s+6;p<e;)
+  {
+    const char* q=scan1(p,e,',');
+    size_t l;
+    const char* v=value(p,q,&l);
+    const char* ve=v+l;
+    p=q+1;
+    if(!l) continue;
+    if(++specs>max) return -1;
+
+    uint64_t a,b;
+    if(*v=='-')
+    {
+// suffix of b bytes
+      if(!(v=number(v+1,ve,&b)) || v!=ve) return -1;
+      if(!b || !size) continue;
+      a=b<size ? size-b : 0;
+      b=size-1;
+    }
+    else
+    {
+      if(!(v=number(v,ve,&a)) || v==ve || *v!='-') return -1;
+      if(++v==ve) b=size-1;
+      else if(!(v=number(v,ve,&b)) || v!=ve || b<a) return -1;
+      if(a>=size) continue;
+      if(b>=size) b=size-1;
+    }
+    r[n].first=a;
+    r[n++].last=b;
+  }
+  return specs ? n : -1;
+}
+
+#define HDR(s_)	(sizeof(s_)-1)
+
+int http_parse(char* b,size_t len,unsigned flags,http_req_t* r)
+{
+  memset(r,0,sizeof(*r));
+  r->close=1;
+  const char* e=b+len;
+
+// request line
+  char* p=(char*)scan3(b,e,' ','\r','\r');
+  if(p==e || *p!=' ') return -1;
+  if(p-b==3 && !strncasecmp(b,"GET",3)) r->method=HTTP_GET;
+  else if(p-b==4 && !strncasecmp(b,"HEAD",4)) r->method=HTTP_HEAD;
+  while(p<e && *p==' ') p++;
+  r->path=p;
+  p=(char*)scan3(p,e,' ','?','\r');
+  r->plen=p-r->path;
+  if(!r->plen) return -1;
+  if(*p=='?')
+  {
+    p=(char*)scan3(p,e,' ','\r','\r');
+    if(flags&HTTP_KEEP_QUERY) r->plen=p-r->path;
+  }
+  if(flags&HTTP_DECODE) r->plen=decode(r->path,r->plen);
+
+  const char* le=scan1(p,e,'\r');
+  while(p<le && *p==' ') p++;
+// HTTP/1.1 and later are persistent by default
+  if(le-p>=8 && !strncmp(p,"HTTP/",5) && (p[5]>'1' || (p[5]=='1' && p[6]=='.' && p[7]>'0'))) r->close=0;
+
+// header lines
+  for(p=(char*)le+2;p<e;)
+  {
+    const char* l=p;
+    le=scan1(l,e,'\r');
+    if(le==l) break;
+    p=(char*)le+2;
+    const char* c=scan1(l,le,':');
+    if(c==le) continue;
+    size_t nl=c-l;
+    c++;
+    switch(*l|0x20)
+    {
+      case 'i':
+        if(nl==HDR("If-None-Match") && !strncasecmp(l,"If-None-Match",nl)) r->inm=value(c,le,&r->inm_len);
+        else if(nl==HDR("If-Range") && !strncasecmp(l,"If-Range",nl)) r->ifr=value(c,le,&r->ifr_len);
+        break;
+      case 'a':
+        if(nl==HDR("Accept-Encoding") && !strncasecmp(l,"Accept-Encoding",nl)) r->ae=value(c,le,&r->ae_len);
+        break;
+      case 'r':
+        if(nl==HDR("Range") && !strncasecmp(l,"Range",nl)) r->range=value(c,le,&r->range_len);
+        break;
+      case 'c':
+        if(nl==HDR("Connection") && !strncasecmp(l,"Connection",nl) && token(c,le,"close",5)) r->close=1;
+        break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,46 @@
+
+//! \file
+//! HTTP/1.x request header parser, no allocations, results point into request buffer
+
+#define HTTP_OTHER	0
+#define HTTP_GET	1
+#define HTTP_HEAD	2
+
+// parser flags
+#define HTTP_DECODE	1u	//!< percent-decode path in place
+#define HTTP_KEEP_QUERY	2u	//!< query string stays part of path
+
+typedef struct http_req_t
+{
+  int method;			//!< HTTP_GET, HTTP_HEAD or HTTP_OTHER
+  int close;			//!< Connection: close, HTTP/1.0 or older
+  char* path;			//!< request target, query string is stripped
+  size_t plen;
+  const char* inm;		//!< If-None-Match value or 0
+  size_t inm_len;
+  const char* ae;		//!< Accept-Encoding value or 0
+  size_t ae_len;
+  const char* range;		//!< Range value or 0
+  size_t range_len;
+  const char* ifr;		//!< If-Range value or 0
+  size_t ifr_len;
+} http_req_t;
+
+//! inclusive byte range
+typedef struct http_range_t
+{
+  uint64_t first;
+  uint64_t last;
+} http_range_t;
+
+//! length of request header ending with empty line, 0 if incomplete; bytes before from are known to hold no end
+size_t http_end(const char* b,size_t len,size_t from);
+
+//! parse complete request header of len bytes, 0 on success, -1 if request line is malformed
+int http_parse(char* b,size_t len,unsigned flags,http_req_t* r);
+
+//! next entity tag of If-None-Match list at *p, W/ is kept, 0 at end of list
+const char* http_etag(const char** p,const char* e,size_t* len);
+
+//! satisfiable ranges of Range value for size bytes to r, -1 if value is malformed, not in bytes or has more than max ranges
+int http_range(const char* s,size_t len,uint64_t size,http_range_t* r,size_t max);
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+#include "macros.h"
+#include "server.h"
+#include "db.h"
+#include "cfg.h"
+#include "http.h"
+#include "conn.h"
+#include "log.h"
+
+#define LOG_BATCH	64		//!< datagrams per sendmmsg
+#define LOG_BUF		(64*KILO)	//!< file writes
+#define LOG_IDLE_MS	10		//!< logger sleep when rings are empty
+
+typedef enum log_target_t
+{
+  LOG_TO_SYSLOG=0,
+  LOG_TO_FILE,
+  LOG_TO_SOCKET
+} log_target_t;
+
+static log_ring_t* rings=0;
+static size_t rings_count=0;
+static log_target_t target;
+static int lfd=-1;
+static _Atomic int stop;
+static pthread_t lthread;
+
+void log_request(log_ring_t* r,const conn_t* c,uint64_t us)
+{
+  if(++r->seq%r->sample) return;
+  uint64_t t=atomic_load_explicit(&r->tail,memory_order_relaxed);
+  if(t-r->head_cache>r->mask)
+  {
+    r->head_cache=atomic_load_explicit(&r->head,memory_order_acquire);
+    if(t-r->head_cache>r->mask)
+    {
+      atomic_store_explicit(&r->dropped,atomic_load_explicit(&r->dropped,memory_order_relaxed)+1,memory_order_relaxed);
+      return;
+    }
+  }
+  log_rec_t* e=r->rec+(t&r->mask);
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE,&ts);
+  e->time=ts.tv_sec*1000ull+ts.tv_nsec/1000000;
+  e->bytes=c->sent;
+  e->us=us<UINT32_MAX ? us : UINT32_MAX;
+  e->status=c->status;
+  e->method=c->req.method;
+  e->plen=c->req.plen<LOG_PATH ? c->req.plen : LOG_PATH;
+  memcpy(e->path,c->req.path,e->plen);
+  atomic_store_explicit(&r->tail,t+1,memory_order_release);
+}
+
+log_ring_t* log_worker(size_t id)
+{
+  return rings ? rings+id : 0;
+}
+
+uint64_t log_dropped(void)
+{
+  uint64_t n=0;
+  for(size_t i=0;i<rings_count;i++) n+=atomic_load_explicit(&rings[i].dropped,memory_order_relaxed);
+  return n;
+}
+
+//! one line without newline, controls and spaces of path are escaped, syslog stamps its own time
+static size_t format(char* b,size_t w,const log_rec_t* e,int stamp)
+{
+  static const char* methods[]={"-","GET","HEAD"};
+  char* p=b;
+  if(stamp)
+  {
+    time_t s=e->time/1000;
+    struct tm tm;
+    gmtime_r(&s,&tm);
+    p+=strftime(p,32,"%Y-%m-%dT%H:%M:%S",&tm);
+    p+=sprintf(p,".%03uZ ",(unsigned)(e->time%1000));
+  }
+  p+=sprintf(p,"%zu %s ",w,methods[e->method<3 ? e->method : 0]);
+  for(size_t i=0;i<e->plen;i++)
+  {
+    unsigned char ch=e->path[i];
+    if(ch>' ' && ch<0x7f && ch!='\\') *p++=ch;
+    else p+=sprintf(p,"\\x%02x",ch);
+  }
+  if(!e->plen) *p++='-';
+  p+=sprintf(p," %u %lu %u",e->status,e->bytes,e->us);
+  return p-b;
+}
+
+//! lines of records are batched per target, 1 if any were taken
+static int drain(char* buf)
+{
+  static char lines[LOG_BATCH][LOG_PATH*4+128];
+  struct mmsghdr mm[LOG_BATCH];
+  struct iovec iv[LOG_BATCH];
+  size_t len=0,nm=0;
+  int any=0;
+
+  for(size_t w=0;w<rings_count;w++)
+  {
+    log_ring_t* r=rings+w;
+    uint64_t h=atomic_load_explicit(&r->head,memory_order_relaxed);
+    uint64_t t=atomic_load_explicit(&r->tail,memory_order_acquire);
+    for(;h<t;h++)
+    {
+      const log_rec_t* e=r->rec+(h&r->mask);
+      any=1;
+      switch(target)
+      {
+        case LOG_TO_FILE:
+          if(len+sizeof(lines[0])>LOG_BUF)
+          {
+            write(lfd,buf,len);
+            len=0;
+          }
+          len+=format(buf+len,w,e,1);
+          buf[len++]='\n';
+          break;
+        case LOG_TO_SOCKET:
+          iv[nm]=(struct iovec){lines[nm],format(lines[nm],w,e,1)};
+          mm[nm]=(struct mmsghdr){.msg_hdr={.msg_iov=iv+nm,.msg_iovlen=1}};
+          if(++nm==LOG_BATCH)
+          {
+            sendmmsg(lfd,mm,nm,0);
+            nm=0;
+          }
+          break;
+        default:
+          lines[0][format(lines[0],w,e,0)]=0;
+          syslog(LOG_INFO,"%s",lines[0]);
+      }
+    }
+    atomic_store_explicit(&r->head,h,memory_order_release);
+  }
+  if(len) write(lfd,buf,len);
+  if(nm) sendmmsg(lfd,mm,nm,0);
+  return any;
+}
+
+static void* logger(void* arg)
+{
+  char* buf=md_malloc(LOG_BUF);
+  uint64_t reported=0;
+  for(;;)
+  {
+    int last=atomic_load(&stop);
+    if(drain(buf)) continue;
+    if(last) break;
+// losses are reported in the log itself when it catches up
+    uint64_t d=log_dropped();
+    if(d!=reported)
+    {
+      if(target==LOG_TO_SYSLOG) syslog(LOG_WARNING,"access log dropped %lu records",d-reported);
+      else
+      {
+        int n=snprintf(buf,LOG_BUF,"access log dropped %lu records\n",d-reported);
+        if(target==LOG_TO_FILE) write(lfd,buf,n);
+        else send(lfd,buf,n-1,0);
+      }
+      reported=d;
+    }
+    nanosleep(&(struct timespec){0,LOG_IDLE_MS*1000000},0);
+  }
+  md_free(buf);
+  return 0;
+}
+
+static int dgram(const char* path)
+{
+  int fd=socket(AF_UNIX,SOCK_DGRAM|SOCK_CLOEXEC,0);
+  if(fd<0) $abort("log socket");
+  struct sockaddr_un a={.sun_family=AF_UNIX};
+  if(strlen(path)>=sizeof(a.sun_path)) $abort("log socket path too long");
+  strcpy(a.sun_path,path);
+  if(connect(fd,(struct sockaddr*)&a,sizeof(a))) $abort("log socket connect");
+  return fd;
+}
+
+void log_start(const cfg_server_t* cfg,size_t workers)
+{
+  if(!cfg->log_request) return;
+  size_t n=64;
+  while(n<(size_t)cfg->log_ring) n*=2;
+  rings_count=workers;
+  rings=aligned_alloc(64,workers*sizeof(log_ring_t));
+  if(!rings) $abort("mem");
+  memset(rings,0,workers*sizeof(log_ring_t));
+  for(size_t i=0;i<workers;i++)
+  {
+    rings[i].mask=n-1;
+    rings[i].sample=cfg->log_sample>1 ? cfg->log_sample : 1;
+    rings[i].rec=md_tmalloc(log_rec_t,n);
+  }
+
+  if(cfg->log_file)
+  {
+    target=LOG_TO_FILE;
+    lfd=open(cfg->log_file,O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,0644);
+    if(lfd<0) $abort("log file");
+  }
+  else if(cfg->log_socket)
+  {
+    target=LOG_TO_SOCKET;
+    lfd=dgram(cfg->log_socket);
+  }
+  else
+  {
+    target=LOG_TO_SYSLOG;
+    openlog(cfg->log_id,LOG_NDELAY|LOG_PID,cfg->log_facility);
+  }
+  atomic_store(&stop,0);
+  if(pthread_create(&lthread,0,logger,0)) $abort("logger start");
+$msg("request log with %zu records per worker, 1 of %u requests",n,rings[0].sample);
+}
+
+void log_stop(void)
+{
+  if(!rings) return;
+  atomic_store(&stop,1);
+  pthread_join(lthread,0);
+  if(target==LOG_TO_SYSLOG) closelog();
+  else close(lfd);
+  lfd=-1;
+  for(size_t i=0;i<rings_count;i++) md_free(rings[i].rec);
+  md_free(rings);
+  rings=0;
+  rings_count=0;
+}
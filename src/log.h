@@ -0,0 +1,44 @@
+
+//! \file
+//! access log, workers fill own single producer rings, logger thread drains them to file, syslog or unix datagram socket
+
+#define LOG_PATH	232		//!< stored bytes of request path, record is 256 bytes
+
+typedef struct log_rec_t
+{
+  uint64_t time;			//!< realtime ms of last byte
+  uint64_t bytes;
+  uint32_t us;				//!< first byte of request to last byte of response
+  uint16_t status;
+  uint8_t method;
+  uint8_t plen;
+  char path[LOG_PATH];
+} log_rec_t;
+
+//! producer and consumer indexes are on own cache lines, full ring drops records
+typedef struct log_ring_t
+{
+  _Atomic uint64_t tail __attribute__((aligned(64)));	//!< written by worker
+  uint64_t head_cache;			//!< last seen head, refreshed when ring looks full
+  uint64_t seq;				//!< completed requests, for sampling
+  _Atomic uint64_t dropped;
+  _Atomic uint64_t head __attribute__((aligned(64)));	//!< written by logger
+  size_t mask;
+  uint32_t sample;
+  log_rec_t* rec;
+} log_ring_t;
+
+struct cfg_server_t;
+struct conn_t;
+
+//! rings for workers and logger thread if request log is on
+void log_start(const struct cfg_server_t* cfg,size_t workers);
+//! remaining records are written before return
+void log_stop(void);
+//! ring of worker, 0 if request log is off
+log_ring_t* log_worker(size_t id);
+//! records lost to full rings
+uint64_t log_dropped(void);
+
+//! completed response of c, never blocks
+void log_request(log_ring_t* r,const struct conn_t* c,uint64_t us);
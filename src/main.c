@@ -10,7 +10,7 @@
 #include "cfg.h"
 #include "server.h"
 
-static const char* usage="c0defeed [-b buildconfig.json | -t buildfromtiles.json | -s serverconfig.json]\nOptions are mutually exclusive\n";
+static const char* usage="c0defeed [-b buildconfig.json | -t buildfromtiles.json | -s serverconfig.json | -v dbfolder]\nOptions are mutually exclusive\n";
 
 
 int main(int ac,char** av)
@@ -18,9 +18,10 @@ int main(int ac,char** av)
   int c;
   const char* scfg=0;
   const char* bcfg=0;
+  const char* vdb=0;
   int tiles=0;
 
-  while((c=getopt(ac,av,"hb:s:t:"))!=-1)
+  while((c=getopt(ac,av,"hb:s:t:v:"))!=-1)
     switch (c)
     {
       case 'h':
@@ -37,11 +38,14 @@ int main(int ac,char** av)
       case 's':
         scfg=optarg;
         break;
+      case 'v':
+        vdb=optarg;
+        break;
       default:
         fprintf(stderr,"%s",usage);
         return -1;
     }
-  if(scfg && bcfg)
+  if((scfg!=0)+(bcfg!=0)+(vdb!=0)>1)
   {
     fprintf(stderr,"%s",usage);
     return -1;
@@ -56,6 +60,16 @@ int main(int ac,char** av)
     return 0;
   }
 
+  if(vdb)
+  {
+    db_t* db=db_open(vdb,0);
+    if(!db) return 1;
+    size_t bad=db_scrub(db,0,1);
+    db_close(db);
+    $msg("verification done, %zu bad chunks",bad);
+    return bad ? 1 : 0;
+  }
+
   if(scfg)
   {
     cfg_server_t* cs=cfg_init_server(scfg);
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "macros.h"
+#include "server.h"
+#include "db.h"
+#include "cfg.h"
+#include "http.h"
+#include "conn.h"
+#include "metrics.h"
+#include "log.h"
+
+#define METRICS_INBUF	2048
+
+static metrics_t* workers=0;
+static size_t workers_count=0;
+
+static const cfg_server_t* mcfg=0;
+static int mfd=-1;
+static int stopfd=-1;
+static pthread_t mthread;
+
+void metrics_init(size_t n)
+{
+  workers=aligned_alloc(64,n*sizeof(metrics_t));
+  if(!workers) $abort("mem");
+  memset(workers,0,n*sizeof(metrics_t));
+  workers_count=n;
+}
+
+void metrics_free(void)
+{
+  md_free(workers);
+  workers=0;
+  workers_count=0;
+}
+
+metrics_t* metrics_worker(size_t id)
+{
+  return workers+id;
+}
+
+//! minor and major faults of thread from its stat, fields after command name
+static int faults(int tid,uint64_t* minor,uint64_t* major)
+{
+  char p[64],s[1024];
+  snprintf(p,sizeof(p),"/proc/self/task/%d/stat",tid);
+  FILE* f=fopen(p,"r");
+  if(!f) return -1;
+  size_t n=fread(s,1,sizeof(s)-1,f);
+  fclose(f);
+  s[n]=0;
+  const char* c=strrchr(s,')');
+  return c && sscanf(c+1," %*c %*d %*d %*d %*d %*d %*u %lu %*u %lu",minor,major)==2 ? 0 : -1;
+}
+
+//! exclusive upper bound of latency bucket in microseconds
+static uint64_t bucket_le(unsigned i)
+{
+  if(i<METRICS_SUB) return i+1;
+  unsigned e=i/METRICS_SUB+METRICS_SUB_BITS-1;
+  return (uint64_t)(METRICS_SUB+i%METRICS_SUB+1)<<(e-METRICS_SUB_BITS);
+}
+
+#define LOAD(x_)	atomic_load_explicit(&(x_),memory_order_relaxed)
+
+static void counter(FILE* o,const char* name,const char* help,uint64_t v)
+{
+  fprintf(o,"# HELP %s %s\n# TYPE %s counter\n%s %lu\n",name,help,name,name,v);
+}
+
+//! workers are summed, histogram count is taken from the same snapshot as its buckets
+static char* scrape(size_t* len)
+{
+  static const char* codes[METRICS_STATUS]={"200","206","304","404","416"};
+  uint64_t accepted=0,closed=0,timeouts=0,bytes=0,partial=0,paged=0,sum=0;
+  uint64_t status[METRICS_STATUS]={0,},lat[METRICS_BUCKETS]={0,};
+  for(size_t w=0;w<workers_count;w++)
+  {
+    metrics_t* m=workers+w;
+    accepted+=LOAD(m->accepted);
+    closed+=LOAD(m->closed);
+    timeouts+=LOAD(m->timeouts);
+    bytes+=LOAD(m->bytes);
+    partial+=LOAD(m->partial);
+    paged+=LOAD(m->paged);
+    sum+=LOAD(m->latency_sum);
+    for(size_t i=0;i<METRICS_STATUS;i++) status[i]+=LOAD(m->status[i]);
+    for(size_t i=0;i<METRICS_BUCKETS;i++) lat[i]+=LOAD(m->latency[i]);
+  }
+
+  char* m=0;
+  FILE* o=open_memstream(&m,len);
+  uint64_t req=0;
+  for(size_t i=0;i<METRICS_STATUS;i++) req+=status[i];
+  counter(o,"decca_requests_total","Requests answered.",req);
+  counter(o,"decca_hits_total","Requests of stored keys.",req-status[METRICS_404]);
+  fprintf(o,"# HELP decca_responses_total Responses by status.\n# TYPE decca_responses_total counter\n");
+  for(size_t i=0;i<METRICS_STATUS;i++) fprintf(o,"decca_responses_total{code=\"%s\"} %lu\n",codes[i],status[i]);
+  counter(o,"decca_sent_bytes_total","Response bytes sent.",bytes);
+  counter(o,"decca_send_partial_total","Sends stopped by full socket buffer.",partial);
+  counter(o,"decca_paged_total","Responses waiting for I/O threads to page in their value.",paged);
+  counter(o,"decca_connections_accepted_total","Connections accepted.",accepted);
+  counter(o,"decca_connections_timeout_total","Connections closed by timeout.",timeouts);
+  counter(o,"decca_log_dropped_total","Access log records lost to full rings.",log_dropped());
+  fprintf(o,"# HELP decca_connections_active Open connections.\n# TYPE decca_connections_active gauge\ndecca_connections_active %lu\n",accepted-closed);
+
+  fprintf(o,"# HELP decca_request_duration_seconds First byte of request to last byte of response.\n# TYPE decca_request_duration_seconds histogram\n");
+  uint64_t cum=0;
+  for(unsigned i=0;i<METRICS_BUCKETS-1;i++)
+  {
+    cum+=lat[i];
+    fprintf(o,"decca_request_duration_seconds_bucket{le=\"%g\"} %lu\n",bucket_le(i)*1e-6,cum);
+  }
+  cum+=lat[METRICS_BUCKETS-1];
+  fprintf(o,"decca_request_duration_seconds_bucket{le=\"+Inf\"} %lu\n",cum);
+  fprintf(o,"decca_request_duration_seconds_sum %g\ndecca_request_duration_seconds_count %lu\n",sum*1e-6,cum);
+
+  fprintf(o,"# HELP decca_page_faults_total Page faults of worker threads.\n# TYPE decca_page_faults_total counter\n");
+  for(size_t w=0;w<workers_count;w++)
+  {
+    uint64_t minor,major;
+    if(!workers[w].tid || faults(workers[w].tid,&minor,&major)) continue;
+    fprintf(o,"decca_page_faults_total{worker=\"%zu\",type=\"minor\"} %lu\n",w,minor);
+    fprintf(o,"decca_page_faults_total{worker=\"%zu\",type=\"major\"} %lu\n",w,major);
+  }
+  fclose(o);
+  return m;
+}
+
+static void write_all(int fd,struct iovec* v,int n)
+{
+  while(n)
+  {
+    ssize_t k=writev(fd,v,n);
+    if(k<=0) return;
+    for(;n && (size_t)k>=v->iov_len;v++,n--) k-=v->iov_len;
+    if(n)
+    {
+      v->iov_base+=k;
+      v->iov_len-=k;
+    }
+  }
+}
+
+//! one request per connection
+static void answer(int fd)
+{
+  char b[METRICS_INBUF+1];
+  size_t len=0,end=0;
+  while(!(end=http_end(b,len,len)) && len<METRICS_INBUF)
+  {
+    ssize_t n=read(fd,b+len,METRICS_INBUF-len);
+    if(n<=0) return;
+    len+=n;
+    b[len]=0;
+  }
+  if(!end) return;
+
+  http_req_t r={0,};
+  const char* status="404 Not Found";
+  char* body=0;
+  size_t blen=0;
+  const char* ct="text/plain";
+  if(!http_parse(b,end,0,&r) && r.method!=HTTP_OTHER)
+  {
+    if(r.plen==8 && !memcmp(r.path,"/metrics",8))
+    {
+      status="200 OK";
+      ct="text/plain; version=0.0.4";
+      body=scrape(&blen);
+    }
+    else if(r.plen==strlen(mcfg->health) && !memcmp(r.path,mcfg->health,r.plen))
+    {
+      int down=atomic_load(&ctrl_flags)&CTRL_FLAG_SHUTDOWN;
+      status=down ? "503 Service Unavailable" : "200 OK";
+      body=md_strdup(down ? "shutting down\n" : "ok\n");
+      blen=strlen(body);
+    }
+  }
+  char h[256];
+  int hl=snprintf(h,sizeof(h),"HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",status,ct,blen);
+  struct iovec v[2]={{h,hl},{body,r.method==HTTP_HEAD ? 0 : blen}};
+  write_all(fd,v,2);
+  md_free(body);
+}
+
+static void* serve(void* arg)
+{
+  struct pollfd p[2]={{.fd=mfd,.events=POLLIN},{.fd=stopfd,.events=POLLIN}};
+  for(;;)
+  {
+    if(poll(p,2,-1)<0)
+    {
+      if(errno==EINTR) continue;
+      perror("metrics poll");
+      break;
+    }
+    if(p[1].revents) break;
+    int f=accept4(mfd,0,0,SOCK_CLOEXEC);
+    if(f<0) continue;
+// slow scraper does not hold listener for long
+    struct timeval t={1,0};
+    setsockopt(f,SOL_SOCKET,SO_RCVTIMEO,&t,sizeof(t));
+    setsockopt(f,SOL_SOCKET,SO_SNDTIMEO,&t,sizeof(t));
+    answer(f);
+    close(f);
+  }
+  return 0;
+}
+
+void metrics_start(const cfg_server_t* cfg,int lfd)
+{
+  mcfg=cfg;
+  mfd=lfd;
+  stopfd=eventfd(0,EFD_CLOEXEC);
+  if(stopfd<0) $abort("metrics eventfd");
+  if(pthread_create(&mthread,0,serve,0)) $abort("metrics start");
+}
+
+void metrics_stop(void)
+{
+  if(mfd<0) return;
+  uint64_t one=1;
+  write(stopfd,&one,sizeof(one));
+  pthread_join(mthread,0);
+  close(stopfd);
+  close(mfd);
+  stopfd=mfd=-1;
+}
@@ -0,0 +1,87 @@
+
+//! \file
+//! per worker counters and latency histograms, summed on scrape of separate listener in Prometheus text format
+
+//! latency buckets are log-linear in microseconds, 1<<METRICS_SUB_BITS per power of 2, last one is unbounded
+#define METRICS_SUB_BITS	2
+#define METRICS_SUB		(1u<<METRICS_SUB_BITS)
+#define METRICS_BUCKETS		100
+
+typedef enum metrics_status_t
+{
+  METRICS_200=0,
+  METRICS_206,
+  METRICS_304,
+  METRICS_404,
+  METRICS_416,
+  METRICS_STATUS
+} metrics_status_t;
+
+//! written by its worker only, padded so workers do not share cache lines
+typedef struct metrics_t
+{
+  _Atomic uint64_t accepted;
+  _Atomic uint64_t closed;
+  _Atomic uint64_t timeouts;		//!< connections evicted by timer wheel
+  _Atomic uint64_t status[METRICS_STATUS];
+  _Atomic uint64_t bytes;		//!< response bytes handed to kernel
+  _Atomic uint64_t partial;		//!< sends stopped by full socket buffer
+  _Atomic uint64_t paged;		//!< values not in memory handed to I/O threads
+  _Atomic uint64_t latency_sum;		//!< microseconds
+  _Atomic uint64_t latency[METRICS_BUCKETS];
+  int tid;				//!< worker thread for fault counts
+} __attribute__((aligned(64))) metrics_t;
+
+struct cfg_server_t;
+
+//! single writer, relaxed store is enough for readers to see whole values
+static inline void metrics_add(_Atomic uint64_t* x,uint64_t n)
+{
+  atomic_store_explicit(x,atomic_load_explicit(x,memory_order_relaxed)+n,memory_order_relaxed);
+}
+
+static inline uint64_t metrics_clock(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return t.tv_sec*1000000000ull+t.tv_nsec;
+}
+
+static inline unsigned metrics_bucket(uint64_t us)
+{
+  if(us<METRICS_SUB) return us;
+  unsigned e=63-__builtin_clzll(us);
+  unsigned i=(e-METRICS_SUB_BITS+1)*METRICS_SUB+((us>>(e-METRICS_SUB_BITS))&(METRICS_SUB-1));
+  return i<METRICS_BUCKETS ? i : METRICS_BUCKETS-1;
+}
+
+//! response with HTTP status is ready
+static inline void metrics_response(metrics_t* m,int status)
+{
+  switch(status)
+  {
+    case 200: metrics_add(m->status+METRICS_200,1); break;
+    case 206: metrics_add(m->status+METRICS_206,1); break;
+    case 304: metrics_add(m->status+METRICS_304,1); break;
+    case 416: metrics_add(m->status+METRICS_416,1); break;
+    default: metrics_add(m->status+METRICS_404,1);
+  }
+}
+
+//! last byte of response is sent, start is metrics_clock at first byte of request, returns latency in us
+static inline uint64_t metrics_done(metrics_t* m,uint64_t start)
+{
+  uint64_t us=(metrics_clock()-start)/1000;
+  metrics_add(m->latency+metrics_bucket(us),1);
+  metrics_add(&m->latency_sum,us);
+  return us;
+}
+
+//! counters of workers, zeroed
+void metrics_init(size_t workers);
+void metrics_free(void);
+metrics_t* metrics_worker(size_t id);
+
+//! thread answering /metrics and health path on listener lfd
+void metrics_start(const struct cfg_server_t* cfg,int lfd);
+void metrics_stop(void);
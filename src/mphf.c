@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <xxhash.h>
+
+#include "macros.h"
+#include "mphf.h"
+
+#define MPHF_MAGIC	0x32666870U	// "phf2"
+#define MPHF_LAMBDA	5		// average keys per bucket
+#define MPHF_ALPHA	97		// load factor of partition table, percents
+#define MPHF_PARTITION	4096		// average keys per partition
+#define MPHF_SKEW	0x9999999999999999ULL	// 60% of keys go to 30% of buckets
+#define MPHF_PILOTS	65536
+#define MPHF_ATTEMPTS	64
+#define MPHF_BUCKETS	((MPHF_PARTITION+MPHF_LAMBDA-1)/MPHF_LAMBDA)	// pilots of every partition
+#define MPHF_BASE	((1ULL<<56)-1)	// slot part of mphf_part_t.base, seed attempt is above
+
+typedef struct mphf_header_t
+{
+  uint32_t magic;
+  uint32_t partitions;
+  uint64_t n;
+  uint64_t seed;
+  uint64_t pilots;		//!< total number of pilots, MPHF_BUCKETS per partition
+  uint64_t remaps;		//!< total number of remap entries
+  uint8_t reserved[24];
+} mphf_header_t;
+
+//! pilots of partition are found from its number, descriptor is read in parallel with them
+typedef struct mphf_part_t
+{
+  uint64_t base;		//!< first slot of partition, attempt of seed in top 8 bits
+  uint32_t n;
+  uint32_t remap;		//!< first remap entry, table positions >= n are remapped
+} mphf_part_t;
+
+_Static_assert(sizeof(mphf_header_t)==64,"mphf_header_t size changed");
+_Static_assert(sizeof(mphf_part_t)==16,"mphf_part_t size changed");
+
+struct mphf_t
+{
+  const mphf_header_t* h;
+  const mphf_part_t* parts;
+  const uint16_t* pilots;
+  const uint32_t* remap;
+};
+
+static inline uint64_t mphf_mix(uint64_t x)
+{
+  x^=x>>33;
+  x*=0xff51afd7ed558ccdULL;
+  x^=x>>33;
+  x*=0xc4ceb9fe1a85ec53ULL;
+  x^=x>>33;
+  return x;
+}
+
+static inline uint64_t mphf_range(uint64_t x,uint64_t n)
+{
+  return ((unsigned __int128)x*n)>>64;
+}
+
+static inline uint32_t mphf_table(uint32_t n)
+{
+  return ((uint64_t)n*100+MPHF_ALPHA-1)/MPHF_ALPHA;
+}
+
+static inline uint32_t mphf_bucket(uint64_t hi,uint32_t b)
+{
+  uint64_t x=mphf_mix(hi);
+  uint64_t y=mphf_mix(x);
+  uint32_t dense=b*3/10;
+  if(!dense) return mphf_range(y,b);
+  return x<MPHF_SKEW ? mphf_range(y,dense) : dense+mphf_range(y,b-dense);
+}
+
+static inline uint64_t mphf_part_seed(uint64_t seed,uint64_t i,uint64_t a)
+{
+  return mphf_mix(seed^(i<<8)^a);
+}
+
+static inline uint32_t mphf_pos(uint64_t lo,uint64_t seed,uint32_t pilot,uint32_t m)
+{
+  return mphf_range(mphf_mix(lo^seed^((pilot+1ULL)*0x9e3779b97f4a7c15ULL)),m);
+}
+
+//! pilots are padded to keep remap table aligned
+static inline size_t mphf_pilots_size(uint64_t pilots)
+{
+  return (pilots*sizeof(uint16_t)+3)&~(size_t)3;
+}
+
+static inline size_t mphf_size(uint32_t partitions,uint64_t pilots,uint64_t remaps)
+{
+  return sizeof(mphf_header_t)+partitions*sizeof(mphf_part_t)+mphf_pilots_size(pilots)+remaps*sizeof(uint32_t);
+}
+
+mphf_key_t mphf_hash(const void* key,size_t len,uint64_t seed)
+{
+  XXH128_hash_t h=XXH3_128bits_withSeed(key,len,seed);
+  return (mphf_key_t){.hi=h.high64,.lo=h.low64};
+}
+
+
+//! per thread scratch of partition builder
+typedef struct mphf_scratch_t
+{
+  uint32_t* count;
+  uint32_t* start;
+  uint32_t* order;
+  uint32_t* keys;
+  uint64_t* taken;
+  uint32_t* pos;
+  size_t cap;
+  mphf_key_t dup;		//!< key of failed duplicate check
+} mphf_scratch_t;
+
+typedef struct mphf_build_t
+{
+  mphf_key_t* keys;
+  uint64_t seed;
+  mphf_header_t* h;
+  mphf_part_t* parts;
+  uint16_t* pilots;
+  uint32_t* remap;
+  _Atomic size_t next;
+  _Atomic int fail;		//!< first failure of mphf_build_part
+  mphf_key_t dup;
+} mphf_build_t;
+
+static void mphf_scratch_grow(mphf_scratch_t* s,size_t n)
+{
+  if(n<=s->cap) return;
+  s->cap=n;
+  s->count=md_realloc(s->count,n*sizeof(uint32_t));
+  s->start=md_realloc(s->start,(n+1)*sizeof(uint32_t));
+  s->order=md_realloc(s->order,n*sizeof(uint32_t));
+  s->keys=md_realloc(s->keys,n*sizeof(uint32_t));
+  s->taken=md_realloc(s->taken,(mphf_table(n)/64+1)*sizeof(uint64_t));
+  s->pos=md_realloc(s->pos,n*sizeof(uint32_t));
+}
+
+static void mphf_scratch_free(mphf_scratch_t* s)
+{
+  md_free(s->count);
+  md_free(s->start);
+  md_free(s->order);
+  md_free(s->keys);
+  md_free(s->taken);
+  md_free(s->pos);
+}
+
+//! 0 - done, 1 - pilot not found, retry with other seed, -1 - duplicate keys
+static int mphf_build_part(const mphf_key_t* keys,uint32_t n,uint64_t seed,uint16_t* pilots,uint32_t* remap,mphf_scratch_t* s)
+{
+  uint32_t b=MPHF_BUCKETS;
+  uint32_t m=mphf_table(n);
+  mphf_scratch_grow(s,b>n ? b : n);
+
+// group keys by buckets
+  memset(s->count,0,b*sizeof(uint32_t));
+  for(uint32_t i=0;i<n;i++) s->count[mphf_bucket(keys[i].hi,b)]++;
+  uint32_t maxsz=0;
+  s->start[0]=0;
+  for(uint32_t i=0;i<b;i++)
+  {
+    s->start[i+1]=s->start[i]+s->count[i];
+    if(s->count[i]>maxsz) maxsz=s->count[i];
+  }
+  for(uint32_t i=0;i<n;i++)
+  {
+    uint32_t q=mphf_bucket(keys[i].hi,b);
+    s->keys[s->start[q+1]-s->count[q]--]=i;
+  }
+
+// largest buckets first
+  {
+    uint32_t sizes[maxsz+2];
+    memset(sizes,0,sizeof(sizes));
+    for(uint32_t i=0;i<b;i++) sizes[s->start[i+1]-s->start[i]]++;
+    for(uint32_t i=maxsz,acc=0;i!=UINT32_MAX;i--)
+    {
+      uint32_t c=sizes[i];
+      sizes[i]=acc;
+      acc+=c;
+    }
+    for(uint32_t i=0;i<b;i++) s->order[sizes[s->start[i+1]-s->start[i]]++]=i;
+  }
+
+  memset(s->taken,0,(m/64+1)*sizeof(uint64_t));
+  memset(pilots,0,b*sizeof(uint16_t));
+
+  for(uint32_t i=0;i<b;i++)
+  {
+    uint32_t q=s->order[i];
+    const uint32_t* bk=s->keys+s->start[q];
+    uint32_t sz=s->start[q+1]-s->start[q];
+    if(!sz) break;
+
+    for(uint32_t j=1;j<sz;j++)
+      for(uint32_t k=0;k<j;k++)
+        if(keys[bk[j]].lo==keys[bk[k]].lo)
+        {
+          s->dup=keys[bk[j]];
+          return -1;
+        }
+
+    uint32_t pilot=0;
+    for(;pilot<MPHF_PILOTS;pilot++)
+    {
+      uint32_t j=0;
+      for(;j<sz;j++)
+      {
+        uint32_t p=mphf_pos(keys[bk[j]].lo,seed,pilot,m);
+        if(s->taken[p/64]&(1ULL<<(p%64))) break;
+        uint32_t k=0;
+        while(k<j && s->pos[k]!=p) k++;
+        if(k<j) break;
+        s->pos[j]=p;
+      }
+      if(j==sz) break;
+    }
+    if(pilot==MPHF_PILOTS) return 1;
+
+    pilots[q]=pilot;
+    for(uint32_t j=0;j<sz;j++) s->taken[s->pos[j]/64]|=1ULL<<(s->pos[j]%64);
+  }
+
+// positions behind n are moved to free slots
+  for(uint32_t p=n,f=0;p<m;p++)
+  {
+    remap[p-n]=0;
+    if(!(s->taken[p/64]&(1ULL<<(p%64)))) continue;
+    while(s->taken[f/64]&(1ULL<<(f%64))) f++;
+    remap[p-n]=f++;
+  }
+
+  return 0;
+}
+
+static void* mphf_build_thread(void* arg)
+{
+  mphf_build_t* t=arg;
+  mphf_scratch_t s={0,};
+
+  for(size_t i;!atomic_load_explicit(&t->fail,memory_order_relaxed) && (i=atomic_fetch_add(&t->next,1))<t->h->partitions;)
+  {
+    mphf_part_t* p=t->parts+i;
+    int r=1;
+    for(uint64_t a=0;r>0 && a<MPHF_ATTEMPTS;a++)
+    {
+      p->base=(p->base&MPHF_BASE)|a<<56;
+      r=mphf_build_part(t->keys+(p->base&MPHF_BASE),p->n,mphf_part_seed(t->seed,i,a),t->pilots+i*MPHF_BUCKETS,t->remap+p->remap,&s);
+    }
+    int z=0;
+    if(r && atomic_compare_exchange_strong(&t->fail,&z,r) && r<0) t->dup=s.dup;
+  }
+
+  mphf_scratch_free(&s);
+  return 0;
+}
+
+void* mphf_build(mphf_key_t* keys,size_t n,uint64_t seed,size_t threads,size_t* size,mphf_key_t* dup)
+{
+  *dup=(mphf_key_t){0,0};
+  if(!keys || !n || !size) return 0;
+
+  uint32_t partitions=(n+MPHF_PARTITION-1)/MPHF_PARTITION;
+
+// in place distribution of keys between partitions
+  uint64_t* start=md_tcalloc(uint64_t,partitions+1);
+  uint64_t* next=md_tcalloc(uint64_t,partitions);
+  for(size_t i=0;i<n;i++) start[mphf_range(keys[i].hi,partitions)+1]++;
+  for(size_t i=0;i<partitions;i++)
+  {
+    start[i+1]+=start[i];
+    next[i]=start[i];
+  }
+  for(size_t p=0;p<partitions;p++)
+    while(next[p]<start[p+1])
+    {
+      mphf_key_t k=keys[next[p]];
+      size_t q=mphf_range(k.hi,partitions);
+      while(q!=p)
+      {
+        mphf_key_t t=keys[next[q]];
+        keys[next[q]++]=k;
+        k=t;
+        q=mphf_range(k.hi,partitions);
+      }
+      keys[next[p]++]=k;
+    }
+  md_free(next);
+
+  uint64_t pilots=(uint64_t)partitions*MPHF_BUCKETS;
+  uint64_t remaps=0;
+  for(size_t i=0;i<partitions;i++)
+  {
+    uint32_t pn=start[i+1]-start[i];
+    remaps+=mphf_table(pn)-pn;
+  }
+
+  size_t sz=mphf_size(partitions,pilots,remaps);
+  void* rv=md_calloc(sz);
+
+  mphf_build_t t={.keys=keys,.seed=seed};
+  t.h=rv;
+  t.parts=rv+sizeof(mphf_header_t);
+  t.pilots=(void*)(t.parts+partitions);
+  t.remap=(void*)t.pilots+mphf_pilots_size(pilots);
+
+  t.h->magic=MPHF_MAGIC;
+  t.h->partitions=partitions;
+  t.h->n=n;
+  t.h->seed=seed;
+  t.h->pilots=pilots;
+  t.h->remaps=remaps;
+
+  for(size_t i=0,pr=0;i<partitions;i++)
+  {
+    mphf_part_t* p=t.parts+i;
+    p->base=start[i];
+    p->n=start[i+1]-start[i];
+    p->remap=pr;
+    pr+=mphf_table(p->n)-p->n;
+  }
+  md_free(start);
+
+  if(!threads) threads=1;
+  if(threads>partitions) threads=partitions;
+  pthread_t* tp=md_tcalloc(pthread_t,threads);
+  for(size_t i=0;i<threads;i++)
+    if(pthread_create(tp+i,0,mphf_build_thread,&t)) $abort("hash build start");
+  for(size_t i=0;i<threads;i++) pthread_join(tp[i],0);
+  md_free(tp);
+
+  if(t.fail)
+  {
+    if(t.fail<0) *dup=t.dup;
+    md_free(rv);
+    return 0;
+  }
+
+  *size=sz;
+  return rv;
+}
+
+
+mphf_t* mphf_open(const void* data,size_t size)
+{
+  const mphf_header_t* h=data;
+  if(!data || size<sizeof(*h) || h->magic!=MPHF_MAGIC) return 0;
+  if(size!=mphf_size(h->partitions,h->pilots,h->remaps) || h->pilots!=(uint64_t)h->partitions*MPHF_BUCKETS) return 0;
+
+  mphf_t* rv=md_new(rv);
+  rv->h=h;
+  rv->parts=data+sizeof(mphf_header_t);
+  rv->pilots=(const void*)(rv->parts+h->partitions);
+  rv->remap=(const void*)rv->pilots+mphf_pilots_size(h->pilots);
+
+  return rv;
+}
+
+void mphf_close(mphf_t* f)
+{
+  md_free(f);
+}
+
+size_t mphf_count(const mphf_t* f)
+{
+  return f->h->n;
+}
+
+uint64_t mphf_seed(const mphf_t* f)
+{
+  return f->h->seed;
+}
+
+static inline const uint16_t* mphf_pilot(const mphf_t* f,uint64_t i,uint64_t hi)
+{
+  return f->pilots+i*MPHF_BUCKETS+mphf_bucket(hi,MPHF_BUCKETS);
+}
+
+uint64_t mphf_lookup(const mphf_t* f,mphf_key_t k)
+{
+  uint64_t i=mphf_range(k.hi,f->h->partitions);
+  const mphf_part_t* p=f->parts+i;
+  uint16_t pilot=*mphf_pilot(f,i,k.hi);
+  if(!p->n) return 0;
+  uint32_t pos=mphf_pos(k.lo,mphf_part_seed(f->h->seed,i,p->base>>56),pilot,mphf_table(p->n));
+  if(pos>=p->n) pos=f->remap[p->remap+pos-p->n];
+  return (p->base&MPHF_BASE)+pos;
+}
+
+void mphf_prefetch(const mphf_t* f,mphf_key_t k)
+{
+  uint64_t i=mphf_range(k.hi,f->h->partitions);
+  __builtin_prefetch(f->parts+i);
+  __builtin_prefetch(mphf_pilot(f,i,k.hi));
+}
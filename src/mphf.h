@@ -0,0 +1,30 @@
+
+//! \file
+//! partitioned minimal perfect hash function, PTHash family
+//! keys are hashed to 128 bits, split into independent partitions built in parallel,
+//! evaluation reads partition descriptor and 16 bit pilot, both addressed from key alone, and rarely one remap entry
+
+typedef struct mphf_t mphf_t;
+
+typedef struct mphf_key_t
+{
+  uint64_t hi;
+  uint64_t lo;
+} mphf_key_t;
+
+mphf_key_t mphf_hash(const void* key,size_t len,uint64_t seed);
+
+//! build function for n key hashes, keys are reordered, returns serialized form or 0 on failure,
+//! dup gets hash of a key that is not told apart from another one, likely added twice, or zero if pilot search gave up
+void* mphf_build(mphf_key_t* keys,size_t n,uint64_t seed,size_t threads,size_t* size,mphf_key_t* dup);
+
+//! view over serialized function, data must stay valid until mphf_close
+mphf_t* mphf_open(const void* data,size_t size);
+void mphf_close(mphf_t*);
+
+size_t mphf_count(const mphf_t*);
+uint64_t mphf_seed(const mphf_t*);
+
+//! slot of key in [0,n), arbitrary slot for unknown keys
+uint64_t mphf_lookup(const mphf_t*,mphf_key_t k);
+void mphf_prefetch(const mphf_t*,mphf_key_t k);
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "macros.h"
+#include "db.h"
+#include "cfg.h"
+#include "pager.h"
+
+typedef struct pager_job_t
+{
+  struct conn_t* c;
+  pager_queue_t* q;
+  const db_t* db;
+  db_value_t v;
+  db_window_t w;
+} pager_job_t;
+
+static pager_queue_t* queues=0;
+static size_t queues_count=0;
+
+//! jobs of all workers, room for full depth of each
+static pthread_mutex_t jlock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jcond=PTHREAD_COND_INITIALIZER;
+static pager_job_t* jobs=0;
+static size_t jmask,jhead,jtail;
+static int stop;
+
+static pthread_t* threads=0;
+static size_t threads_count=0;
+
+static const uint64_t one=1;
+
+static void* pager(void* arg)
+{
+  for(;;)
+  {
+    pthread_mutex_lock(&jlock);
+    while(jhead==jtail && !stop) pthread_cond_wait(&jcond,&jlock);
+    if(stop)
+    {
+      pthread_mutex_unlock(&jlock);
+      break;
+    }
+    pager_job_t j=jobs[jhead++&jmask];
+    pthread_mutex_unlock(&jlock);
+
+// this is where the major faults are taken
+    int rv=db_value_load(j.db,&j.v,&j.w);
+
+    pager_queue_t* q=j.q;
+    pthread_mutex_lock(&q->lock);
+    int wake=q->head==q->tail;
+    q->done[q->tail++&(PAGER_DEPTH-1)]=(pager_done_t){j.c,rv};
+    pthread_mutex_unlock(&q->lock);
+    if(wake) write(q->efd,&one,sizeof(one));
+  }
+  return 0;
+}
+
+void pager_start(const cfg_server_t* cfg,size_t workers)
+{
+  if(cfg->io_threads<=0) return;
+  queues=aligned_alloc(64,workers*sizeof(pager_queue_t));
+  if(!queues) $abort("mem");
+  memset(queues,0,workers*sizeof(pager_queue_t));
+  for(size_t i=0;i<workers;i++)
+  {
+    pthread_mutex_init(&queues[i].lock,0);
+    queues[i].efd=-1;
+  }
+  queues_count=workers;
+
+  size_t n=PAGER_DEPTH;
+  while(n<workers*PAGER_DEPTH) n*=2;
+  jobs=md_tmalloc(pager_job_t,n);
+  jmask=n-1;
+  jhead=jtail=0;
+  stop=0;
+
+  threads_count=cfg->io_threads;
+  threads=md_tcalloc(pthread_t,threads_count);
+  for(size_t i=0;i<threads_count;i++)
+    if(pthread_create(threads+i,0,pager,0)) $abort("pager start");
+$msg("%zu I/O threads page in values not in memory",threads_count);
+}
+
+void pager_stop(void)
+{
+  if(!queues) return;
+  pthread_mutex_lock(&jlock);
+  stop=1;
+  pthread_cond_broadcast(&jcond);
+  pthread_mutex_unlock(&jlock);
+  for(size_t i=0;i<threads_count;i++) pthread_join(threads[i],0);
+  md_free(threads);
+  threads=0;
+  threads_count=0;
+  md_free(jobs);
+  jobs=0;
+  for(size_t i=0;i<queues_count;i++) pthread_mutex_destroy(&queues[i].lock);
+  md_free(queues);
+  queues=0;
+  queues_count=0;
+}
+
+pager_queue_t* pager_worker(size_t id)
+{
+  return queues ? queues+id : 0;
+}
+
+int pager_submit(pager_queue_t* q,struct conn_t* c,const db_t* db,const db_value_t* v,const db_window_t* w)
+{
+  if(q->inflight==PAGER_DEPTH) return 0;
+  q->inflight++;
+  pthread_mutex_lock(&jlock);
+  jobs[jtail++&jmask]=(pager_job_t){c,q,db,*v,*w};
+  pthread_cond_signal(&jcond);
+  pthread_mutex_unlock(&jlock);
+  return 1;
+}
+
+size_t pager_done(pager_queue_t* q,pager_done_t* out,size_t n)
+{
+  size_t k=0;
+  pthread_mutex_lock(&q->lock);
+  for(;k<n && q->head!=q->tail;k++) out[k]=q->done[q->head++&(PAGER_DEPTH-1)];
+  pthread_mutex_unlock(&q->lock);
+  q->inflight-=k;
+  return k;
+}
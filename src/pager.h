@@ -0,0 +1,35 @@
+
+//! \file
+//! I/O threads page in values that are not in memory, workers answer them when they come back instead of blocking on major faults
+
+#define PAGER_DEPTH	256		//!< values one worker may have in flight, power of 2
+
+typedef struct pager_done_t
+{
+  struct conn_t* c;
+  int rv;				//!< -1 if value failed lazy verification
+} pager_done_t;
+
+//! completions of one worker, filled by I/O threads, wakes worker through efd when it turns non-empty
+typedef struct pager_queue_t
+{
+  pthread_mutex_t lock;
+  pager_done_t done[PAGER_DEPTH];
+  size_t head,tail;
+  int efd;
+  size_t inflight;			//!< worker only
+} __attribute__((aligned(64))) pager_queue_t;
+
+struct cfg_server_t;
+
+//! threads and queues if cfg->io_threads is set, efd of queues is left to caller
+void pager_start(const struct cfg_server_t* cfg,size_t workers);
+//! queued values are dropped, workers must be gone
+void pager_stop(void);
+//! queue of worker, 0 if pager is off
+pager_queue_t* pager_worker(size_t id);
+
+//! window w of v is paged in for c, 0 if worker has too many in flight and has to send itself
+int pager_submit(pager_queue_t* q,struct conn_t* c,const db_t* db,const db_value_t* v,const db_window_t* w);
+//! up to n completions, worker calls it after wakeup until it returns 0
+size_t pager_done(pager_queue_t* q,pager_done_t* out,size_t n);
@@ -2,106 +2,544 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <time.h>
+#include <strings.h>
 #include <stdatomic.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <sys/signalfd.h>
 #include <sys/signal.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <linux/filter.h>
+#include <sched.h>
 #include <arpa/inet.h>
 #include <pthread.h>
-#include <regex.h>
-#include <uthash.h>
 
 #include "macros.h"
 #include "server.h"
 #include "db.h"
 #include "cfg.h"
+#include "http.h"
+#include "conn.h"
+#include "metrics.h"
+#include "log.h"
+#include "pager.h"
 
 #define BACKLOG 1024
+#define CONN_SLAB 64		//!< connections per pool slab
+#define HANDOFF_FDS 253		//!< SCM_MAX_FD, listeners and metrics listener
 
-#define CTRL_FLAG_SHUTDOWN 1u
-#define CTRL_FLAG_RELOAD   2u
+static conn_t sconn;
 
-typedef enum conn_type_t
+static pthread_t* tpool;
+static size_t threads_count=0;
+_Atomic uint32_t ctrl_flags=0;
+//static _Atomic uint64_t actives;
+int sfd=-1;
+static int* lfds=0;			//!< listeners, one per worker with reuseport
+static size_t lfds_count=0;
+
+//! published database, replaced on SIGHUP
+typedef struct db_version_t
 {
-  CONN_SOCKET=0,
-  CONN_LISTEN,
-  CONN_SIGNAL,
-} conn_type_t;
+  db_t* db;
+  uint64_t gen;
+} db_version_t;
+
+static _Atomic(db_version_t*) dbv=0;
+static db_reader_t* readers=0;
+static int ctl_fd=-1;		//!< wakes control thread for reload or stop
+static _Atomic int ctl_stop;
+static pthread_t ctl_thread;
+static int hfd=-1;			//!< handoff listener for upgraded instance
+static int mlfd=-1;			//!< metrics listener
+
+static const uint64_t one=1;
 
-typedef enum conn_state_t
+static inline void writeone(int fd) { write(fd,&one,sizeof(one)); }
+
+//! loop round starts, newest published database is taken
+void reader_enter(db_reader_t* r)
 {
-  STATE_RECV,
-  STATE_SEND,
-  STATE_CLOSE
-} conn_state_t;
+  db_version_t* v=atomic_load_explicit(&dbv,memory_order_acquire);
+  if(v->gen==r->gen) return;
+  r->gen=v->gen;
+  r->db=v->db;
+}
 
-typedef struct conn_t
+//! response of c points into database of current generation
+void reader_hold(db_reader_t* r,conn_t* c)
 {
-  conn_type_t type;
-  int fd;
-  conn_state_t state;
+  c->gen=r->gen;
+  r->refs[c->gen&1]++;
+}
 
-  void* buf;
-  size_t szin;
+void reader_release(db_reader_t* r,conn_t* c)
+{
+  if(!c->gen) return;
+  r->refs[c->gen&1]--;
+  c->gen=0;
+}
 
-  const void* hdr;
-  size_t hdr_sz;
-  size_t hdr_sent;
+//! loop round ends, previous generation is released when its last response is sent
+void reader_leave(db_reader_t* r)
+{
+  uint64_t s=r->refs[(r->gen-1)&1] ? r->gen-1 : r->gen;
+  if(atomic_load_explicit(&r->seen,memory_order_relaxed)!=s) atomic_store_explicit(&r->seen,s,memory_order_release);
+}
 
-  const void* body;
-  size_t body_sz;
-  size_t body_sent;
-  UT_hash_handle hh;
-} conn_t;
+//! hits of previous run are read ahead, hottest blocks first
+static void heat_start(const cfg_server_t* c,db_t* db,int wait)
+{
+  if(!c->heat_file) return;
+  if(db_heat_open(db,c->heat_file,c->heat_sample)) db_warmup(db,c->heat_threads,wait);
+}
 
-static conn_t lconn,sconn;
+//! generation below which responses are overdue after reload, 0 if none
+uint64_t reader_cut(db_reader_t* r)
+{
+  if(!atomic_load_explicit(&r->cut,memory_order_relaxed)) return 0;
+  return atomic_exchange(&r->cut,0);
+}
 
-static pthread_t* tpool;
-static size_t threads_count=0;
-static _Atomic uint32_t ctrl_flags=0;
-//static _Atomic uint64_t actives;
-static int sfd=-1;
-static int lfd=-1;
+//! old database is closed when no worker has response pointing into it, connections still sending after grace period are closed
+static void reload(const cfg_server_t* c)
+{
+  db_t* db=db_open(c->db,c->dbflags);
+  if(!db)
+  {
+    $msg("database reload failed, current one is kept");
+    return;
+  }
+// same database reopened keeps its heat
+  if(c->heat_file) db_heat_save(atomic_load(&dbv)->db,c->heat_file);
+  db_version_t* nv=md_new(nv);
+  nv->db=db;
+  db_resident(nv->db,c);
+  heat_start(c,nv->db,0);
+  if(c->scrub>0) db_scrub(nv->db,c->scrub,0);
+  db_version_t* old=atomic_load(&dbv);
+  nv->gen=old->gen+1;
+  atomic_store_explicit(&dbv,nv,memory_order_release);
+  for(size_t i=0;i<threads_count;i++) writeone(readers[i].efd);
+
+  struct timespec t0,t;
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  for(size_t i=0;i<threads_count && !atomic_load(&ctl_stop);)
+  {
+    if(atomic_load_explicit(&readers[i].seen,memory_order_acquire)>=nv->gen)
+    {
+      i++;
+      continue;
+    }
+// slow readers and paged values done since are cut again until worker releases generation
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    if(c->grace && (t.tv_sec-t0.tv_sec)*1000+(t.tv_nsec-t0.tv_nsec)/1000000>=c->grace && !atomic_load(&readers[i].cut))
+    {
+      atomic_store(&readers[i].cut,nv->gen);
+      writeone(readers[i].efd);
+    }
+    nanosleep(&(struct timespec){0,10000000},0);
+  }
+  db_close(old->db);
+  md_free(old);
+$msg("database generation %lu published",nv->gen);
+}
 
-static db_t* db=0;
+//! listeners of worker order and metrics listener, -1 if none, go to new instance
+static int handoff_send(int fd)
+{
+  int32_t hdr[2]={lfds_count,mlfd>=0 ? (int32_t)lfds_count : -1};
+  size_t n=lfds_count+(mlfd>=0);
+  char* cb=md_calloc(CMSG_SPACE(n*sizeof(int)));
+  struct iovec v={hdr,sizeof(hdr)};
+  struct msghdr m={.msg_iov=&v,.msg_iovlen=1,.msg_control=cb,.msg_controllen=CMSG_SPACE(n*sizeof(int))};
+  struct cmsghdr* h=CMSG_FIRSTHDR(&m);
+  h->cmsg_level=SOL_SOCKET;
+  h->cmsg_type=SCM_RIGHTS;
+  h->cmsg_len=CMSG_LEN(n*sizeof(int));
+  memcpy(CMSG_DATA(h),lfds,lfds_count*sizeof(int));
+  if(mlfd>=0) ((int*)CMSG_DATA(h))[lfds_count]=mlfd;
+  int rv=sendmsg(fd,&m,MSG_NOSIGNAL)==sizeof(hdr) ? 0 : -1;
+  md_free(cb);
+  return rv;
+}
 
-static const char* rpat1="^\\(GET\\|HEAD\\)[[:blank:]]\\+\\([^[:blank:]]\\+\\)";
-static regex_t rre1;
+//! listeners of running instance, 0 if there is none
+static int handoff_receive(const char* path,int* mfd)
+{
+  int fd=socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+  struct sockaddr_un a={.sun_family=AF_UNIX};
+  if(fd<0 || strlen(path)>=sizeof(a.sun_path)) $abort("handoff socket");
+  strcpy(a.sun_path,path);
+  if(connect(fd,(struct sockaddr*)&a,sizeof(a)))
+  {
+    close(fd);
+    return 0;
+  }
+  int32_t hdr[2];
+  union { char b[CMSG_SPACE(HANDOFF_FDS*sizeof(int))]; struct cmsghdr h; } cb;
+  struct iovec v={hdr,sizeof(hdr)};
+  struct msghdr m={.msg_iov=&v,.msg_iovlen=1,.msg_control=cb.b,.msg_controllen=sizeof(cb.b)};
+  ssize_t r=recvmsg(fd,&m,MSG_CMSG_CLOEXEC|MSG_WAITALL);
+  close(fd);
+  struct cmsghdr* h=CMSG_FIRSTHDR(&m);
+  if(r!=sizeof(hdr) || !h || h->cmsg_type!=SCM_RIGHTS || (m.msg_flags&MSG_CTRUNC)) $abort("handoff receive");
+  size_t n=(h->cmsg_len-CMSG_LEN(0))/sizeof(int);
+  if(hdr[0]<1 || (size_t)hdr[0]+(hdr[1]>=0)!=n) $abort("handoff message");
+  lfds_count=hdr[0];
+  lfds=md_tmalloc(int,lfds_count);
+  memcpy(lfds,CMSG_DATA(h),lfds_count*sizeof(int));
+  *mfd=hdr[1]>=0 ? ((int*)CMSG_DATA(h))[hdr[1]] : -1;
+// received descriptors are blocking copies of the same open sockets
+  for(size_t i=0;i<lfds_count;i++) fcntl(lfds[i],F_SETFL,O_NONBLOCK);
+  if(*mfd>=0) fcntl(*mfd,F_SETFL,O_NONBLOCK);
+$msg("took over %zu listeners from running instance",lfds_count);
+  return 1;
+}
 
-static const uint64_t one=1;
+//! workers stop accepting, end idle connections and answer the rest with Connection: close
+static void drain(const cfg_server_t* c)
+{
+  metrics_stop();
+  atomic_fetch_or(&ctrl_flags,CTRL_FLAG_DRAIN);
+  for(size_t i=0;i<threads_count;i++) writeone(readers[i].efd);
+$msg("listeners handed off, draining for up to %d ms",c->drain);
+  struct pollfd p={.fd=ctl_fd,.events=POLLIN};
+  struct timespec t0,t;
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  for(;;)
+  {
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    long left=c->drain-((t.tv_sec-t0.tv_sec)*1000+(t.tv_nsec-t0.tv_nsec)/1000000);
+    if(left<=0 || atomic_load(&ctl_stop)) break;
+    poll(&p,1,left);
+  }
+  if(atomic_load(&ctl_stop)) return;
+  atomic_fetch_or(&ctrl_flags,CTRL_FLAG_SHUTDOWN);
+  for(size_t i=0;i<threads_count;i++) writeone(readers[i].efd);
+}
 
-static inline void writeone(int fd) { write(fd,&one,sizeof(one)); }
+//! reload on SIGHUP, handoff of listeners to upgraded instance, periodic save of heat map
+static void* control(void* arg)
+{
+  const cfg_server_t* c=arg;
+  struct pollfd p[2]={{.fd=ctl_fd,.events=POLLIN},{.fd=hfd,.events=POLLIN}};
+  uint64_t x;
+  while(!atomic_load(&ctl_stop))
+  {
+    int n=poll(p,hfd>=0 ? 2 : 1,c->heat_file ? c->heat_interval : -1);
+    if(n<0 && errno!=EINTR) break;
+    if(!n)
+    {
+      db_heat_save(atomic_load(&dbv)->db,c->heat_file);
+      continue;
+    }
+    if(hfd>=0 && p[1].revents)
+    {
+      int f=accept4(hfd,0,0,SOCK_CLOEXEC);
+      if(f<0) continue;
+      int r=handoff_send(f);
+      if(r) $msg("handoff send error: %m");
+      close(f);
+      if(r) continue;
+      close(hfd);
+      hfd=-1;
+      drain(c);
+      continue;
+    }
+    read(ctl_fd,&x,sizeof(x));
+    if(!(atomic_fetch_and(&ctrl_flags,~CTRL_FLAG_RELOAD)&CTRL_FLAG_RELOAD)) continue;
+    reload(c);
+  }
+  return 0;
+}
+
+//! find requested key and connection persistence, lookup is postponed to batch
+static void request(const cfg_server_t* cfg,conn_t* c)
+{
+  if(http_parse(c->buf,c->rlen,cfg->httpflags,&c->req) || c->req.method==HTTP_OTHER)
+  {
+// unknown method may carry body, request boundary is lost
+    c->req.method=HTTP_OTHER;
+    c->req.plen=0;
+    c->close=1;
+    return;
+  }
+  c->close=c->req.close || !cfg->keepalive || (atomic_load_explicit(&ctrl_flags,memory_order_relaxed)&CTRL_FLAG_DRAIN);
+}
+
+//! complete request in buffer moves connection to lookup
+int conn_parse(const cfg_server_t* cfg,conn_t* c)
+{
+  size_t l=http_end(c->buf,c->szin,c->scanned);
+  c->scanned=c->szin;
+  if(!l) return 0;
+  c->rlen=l;
+  request(cfg,c);
+  c->state=STATE_LOOKUP;
+  return 1;
+}
+
+//! response is sent, drop request and continue with pipelined one
+void conn_next(const cfg_server_t* cfg,conn_t* c)
+{
+  if(c->close)
+  {
+    c->state=STATE_CLOSE;
+    return;
+  }
+  c->szin-=c->rlen;
+  memmove(c->buf,c->buf+c->rlen,c->szin);
+  ((char*)c->buf)[c->szin]=0;
+  c->rlen=0;
+  c->scanned=0;
+  c->start=c->szin ? metrics_clock() : 0;
+  c->state=STATE_RECV;
+  conn_parse(cfg,c);
+}
+
+//! stored headers with empty line, body follows, 0 if record has none
+static size_t head_len(const db_value_t* v)
+{
+  if(v->head) return v->head;
+  const char* b=memmem(v->data,v->len,"\r\n\r\n",4);
+  return b ? b+4-(const char*)v->data : 0;
+}
 
-static const void* content(const char* request,size_t sz,size_t* rsz)
+void conn_pool_init(conn_pool_t* p,size_t inbuf)
 {
-  regmatch_t match[3]={0,};
+  memset(p,0,sizeof(*p));
+  p->inbuf=inbuf;
+  p->slot=(sizeof(conn_t)+inbuf+1+CONN_SCRATCH+63)&~(size_t)63;
+}
 
-  if(regexec(&rre1,request,3,match,0)) return 0;
-  size_t dlen=0;
-  const void* d=db_get2(db,request+match[2].rm_so,match[2].rm_eo-match[2].rm_so,&dlen);
+void conn_pool_free(conn_pool_t* p)
+{
+  for(size_t i=0;i<p->nslabs;i++) md_free(p->slabs[i]);
+  md_free(p->slabs);
+  md_free(p->fds);
+  memset(p,0,sizeof(*p));
+}
 
-  if(!d) return 0;
-  *rsz=dlen;
-  if(request[match[1].rm_so]=='G' || request[match[1].rm_so]=='g')  return d;
+//! input buffer is not cleared, only its first byte
+conn_t* conn_alloc(conn_pool_t* p,int fd)
+{
+  if(!p->free)
+  {
+    char* s=aligned_alloc(64,p->slot*CONN_SLAB);
+    if(!s) $abort("mem");
+    p->slabs=md_realloc(p->slabs,(p->nslabs+1)*sizeof(void*));
+    p->slabs[p->nslabs++]=s;
+    for(size_t i=CONN_SLAB;i--;)
+    {
+      conn_t* c=(conn_t*)(s+i*p->slot);
+      c->next=p->free;
+      p->free=c;
+    }
+  }
+  if((size_t)fd>=p->nfds)
+  {
+    size_t n=p->nfds ? p->nfds : 1024;
+    while(n<=(size_t)fd) n*=2;
+    p->fds=md_realloc(p->fds,n*sizeof(conn_t*));
+    memset(p->fds+p->nfds,0,(n-p->nfds)*sizeof(conn_t*));
+    p->nfds=n;
+  }
 
-  void* b=memmem(d,dlen,"\r\n\r\n",4);
-  if(!b) return 0;
-  *rsz=b-d+4;
-  return d;
+  conn_t* c=p->free;
+  p->free=c->next;
+  memset(c,0,sizeof(*c));
+  c->fd=fd;
+  c->buf=c+1;
+  c->scratch=c->buf+p->inbuf+1;
+  ((char*)c->buf)[0]=0;
+  p->fds[fd]=c;
+  p->live++;
+  return c;
+}
+
+//! descriptor entry may already belong to newer connection reusing it
+void conn_release(conn_pool_t* p,conn_t* c)
+{
+  if(p->fds[c->fd]==c) p->fds[c->fd]=0;
+  c->next=p->free;
+  p->free=c;
+  p->live--;
+}
+
+//! tick is about sixteenth of timeout, deadlines are up to one tick late
+void wheel_init(wheel_t* w,uint32_t timeout)
+{
+  memset(w,0,sizeof(*w));
+  w->timeout=timeout;
+  w->shift=4;
+  while(w->shift<10 && (1u<<(w->shift+4))<timeout) w->shift++;
+  wheel_now(w);
+  w->done=w->now>>w->shift;
+}
+
+void wheel_now(wheel_t* w)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC_COARSE,&t);
+  w->now=t.tv_sec*1000ull+t.tv_nsec/1000000;
+}
+
+static void wheel_link(wheel_t* w,conn_t* c)
+{
+  conn_t** s=w->slot+((c->deadline>>w->shift)&(WHEEL_SLOTS-1));
+  c->tnext=*s;
+  if(*s) (*s)->tprev=&c->tnext;
+  c->tprev=s;
+  *s=c;
+}
+
+static void wheel_unlink(conn_t* c)
+{
+  *c->tprev=c->tnext;
+  if(c->tnext) c->tnext->tprev=c->tprev;
+  c->tprev=0;
+}
+
+//! deadline is timeout from now, linked entry stays in its slot
+void wheel_arm(wheel_t* w,conn_t* c)
+{
+  if(!w->timeout) return;
+  c->deadline=w->now+w->timeout;
+  if(c->tprev) return;
+  wheel_link(w,c);
+  w->count++;
+}
+
+void wheel_cancel(wheel_t* w,conn_t* c)
+{
+  if(!c->tprev) return;
+  wheel_unlink(c);
+  w->count--;
+}
+
+//! elapsed ticks are walked, expired connections are unlinked and passed to fn
+void wheel_expire(wheel_t* w,void (*fn)(void*,conn_t*),void* arg)
+{
+  uint64_t t=w->now>>w->shift;
+  if(t-w->done>WHEEL_SLOTS) w->done=t-WHEEL_SLOTS;
+  for(;w->done<t && w->count;w->done++)
+  {
+    conn_t** s=w->slot+(w->done&(WHEEL_SLOTS-1));
+    for(conn_t* c=*s,*n;c;c=n)
+    {
+      n=c->tnext;
+      if(c->deadline>>w->shift<=w->done)
+      {
+        wheel_cancel(w,c);
+        fn(arg,c);
+      }
+      else if(w->slot+((c->deadline>>w->shift)&(WHEEL_SLOTS-1))!=s)
+      {
+        wheel_unlink(c);
+        wheel_link(w,c);
+      }
+    }
+  }
+  w->done=t;
 }
 
 static void* worker(void* arg);
-static int listen_tcp4(const char *ip,uint16_t port,int backlog);
-static int listen_unix(const char *path, int backlog);
+static int listen_tcp4(const char *ip,uint16_t port,int backlog,int reuseport);
+static int listen_unix(const char *path, int backlog, mode_t mode);
+
+//! cores of process affinity mask
+static size_t cpu_list(int** rv)
+{
+  cpu_set_t s;
+  CPU_ZERO(&s);
+  if(sched_getaffinity(0,sizeof(s),&s)) $abort("sched_getaffinity");
+  size_t n=CPU_COUNT(&s),k=0;
+  *rv=md_tcalloc(int,n);
+  for(int i=0;k<n && i<CPU_SETSIZE;i++)
+    if(CPU_ISSET(i,&s)) (*rv)[k++]=i;
+  return n;
+}
+
+//! reuseport group program returns listener of worker pinned to receiving core, core modulo group size otherwise
+static void steer_bpf(int fd,const worker_arg_t* w,size_t n)
+{
+  struct sock_filter* code=md_tcalloc(struct sock_filter,2*n+3);
+  size_t k=0;
+  code[k++]=(struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS,SKF_AD_OFF+SKF_AD_CPU);
+  for(size_t i=0;i<n;i++)
+  {
+    code[k++]=(struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,w[i].cpu,0,1);
+    code[k++]=(struct sock_filter)BPF_STMT(BPF_RET|BPF_K,i);
+  }
+  code[k++]=(struct sock_filter)BPF_STMT(BPF_ALU|BPF_MOD|BPF_K,n);
+  code[k++]=(struct sock_filter)BPF_STMT(BPF_RET|BPF_A,0);
+  struct sock_fprog p={.len=k,.filter=code};
+  if(setsockopt(fd,SOL_SOCKET,SO_ATTACH_REUSEPORT_CBPF,&p,sizeof(p))) $abort("reuseport steering program");
+  md_free(code);
+}
+
+//! listeners are created in worker order, it is their index in reuseport group
+static void listeners(const cfg_server_t* c,worker_arg_t* w,size_t n)
+{
+// taken over listeners keep reuseport group and steering of previous instance
+  if(lfds)
+  {
+    for(size_t i=0;i<n;i++) w[i].lfd=lfds[i%lfds_count];
+    return;
+  }
+  int reuse=c->reuseport && c->port && n>1;
+  if(c->reuseport && !c->port) $msg("reuseport needs tcp listener, workers share unix socket");
+  lfds_count=reuse ? n : 1;
+  lfds=md_tcalloc(int,lfds_count);
+  for(size_t i=0;i<lfds_count;i++)
+    lfds[i]=c->port ? listen_tcp4(c->socket,c->port,c->backlog,reuse) : listen_unix(c->socket,c->backlog,0666);
+  for(size_t i=0;i<n;i++) w[i].lfd=lfds[reuse ? i : 0];
+  if(!reuse || c->steering==SERVER_STEER_NONE) return;
+  if(!c->pin)
+  {
+    $msg("steering needs pinned workers, ignored");
+    return;
+  }
+  if(c->steering==SERVER_STEER_BPF) steer_bpf(lfds[0],w,n);
+  else
+    for(size_t i=0;i<n;i++)
+      if(setsockopt(lfds[i],SOL_SOCKET,SO_INCOMING_CPU,&w[i].cpu,sizeof(w[i].cpu))) $abort("SO_INCOMING_CPU");
+}
 
 int server_start(const cfg_server_t* c)
 {
   if(!c) $abort("no config provided");
-  regcomp(&rre1,rpat1,REG_NEWLINE|REG_ICASE);
-  db=db_open(c->db);
+#if !USE_URING
+  if(c->backend==SERVER_BACKEND_URING) $abort("io_uring backend is not built, use make URING=1");
+#endif
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGQUIT);
+// signals go to signalfd only, threads inherit the mask, scrub and warmup threads of database too
+  pthread_sigmask(SIG_BLOCK,&mask,0);
+
+  db_version_t* v=md_new(v);
+  v->db=db_open(c->db,c->dbflags);
+  if(!v->db) $abort("open database error");
+  db_resident(v->db,c);
+  heat_start(c,v->db,c->heat_wait);
+  v->gen=1;
+  if(c->scrub>0) db_scrub(v->db,c->scrub,0);
+  atomic_store(&dbv,v);
 
   threads_count=c->threads;
   tpool=md_tcalloc(pthread_t,threads_count);
@@ -113,37 +551,102 @@ int server_start(const cfg_server_t* c)
     if(sigaction(SIGPIPE, &sa, NULL)<0) $abort("sigpipe handler");
   }
 
-  sigset_t mask;
-  sigemptyset(&mask);
-  sigaddset(&mask, SIGINT);
-  sigaddset(&mask, SIGTERM);
-  sigaddset(&mask, SIGHUP);
-  sigaddset(&mask, SIGINT);
-
-  lfd=c->port ? listen_tcp4(c->socket,c->port,c->backlog) : listen_unix(c->socket,c->backlog);
+  worker_arg_t* wargs=md_tcalloc(worker_arg_t,threads_count);
+  int* cpus=0;
+  size_t ncpu=c->pin ? cpu_list(&cpus) : 0;
+  for(size_t i=0;i<threads_count;i++)
+  {
+    wargs[i].cfg=c;
+    wargs[i].id=i;
+    wargs[i].cpu=ncpu ? cpus[i%ncpu] : -1;
+  }
+  readers=aligned_alloc(64,threads_count*sizeof(db_reader_t));
+  if(!readers) $abort("mem");
+  memset(readers,0,threads_count*sizeof(db_reader_t));
+  for(size_t i=0;i<threads_count;i++)
+  {
+    readers[i].efd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    if(readers[i].efd<0) $abort("eventfd");
+    wargs[i].reader=readers+i;
+  }
+  md_free(cpus);
+  pager_start(c,threads_count);
+  if(pager_worker(0))
+    for(size_t i=0;i<threads_count;i++) pager_worker(i)->efd=readers[i].efd;
+
+// database is open before running instance is asked for listeners, traffic does not pause
+  if(c->handoff) handoff_receive(c->handoff,&mlfd);
+  listeners(c,wargs,threads_count);
+  metrics_init(threads_count);
+  log_start(c,threads_count);
+  if(c->metrics_socket && mlfd<0) mlfd=c->metrics_port ? listen_tcp4(c->metrics_socket,c->metrics_port,0,0) : listen_unix(c->metrics_socket,0,0666);
+  if(mlfd>=0) metrics_start(c,mlfd);
+  if(c->handoff) hfd=listen_unix(c->handoff,0,0600);
+
+  ctl_fd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+  if(ctl_fd<0) $abort("eventfd");
+  atomic_store(&ctl_stop,0);
+  if(pthread_create(&ctl_thread,0,control,(void*)c)) $abort("control thread start");
   sfd=signalfd(-1,&mask,SFD_NONBLOCK|SFD_CLOEXEC);
 
-  lconn.fd=lfd;
-  lconn.type=CONN_LISTEN;
   sconn.fd=sfd;
   sconn.type=CONN_SIGNAL;
 
-  for(size_t i=0;i<threads_count;i++) pthread_create(tpool+i,0,worker,(void*)c);
+  void* (*run)(void*)=worker;
+#if USE_URING
+  if(c->backend==SERVER_BACKEND_URING) run=worker_uring;
+#endif
+  for(size_t i=0;i<threads_count;i++)
+  {
+    pthread_attr_t a;
+    pthread_attr_init(&a);
+    if(wargs[i].cpu>=0)
+    {
+      cpu_set_t s;
+      CPU_ZERO(&s);
+      CPU_SET(wargs[i].cpu,&s);
+      pthread_attr_setaffinity_np(&a,sizeof(s),&s);
+    }
+    if(pthread_create(tpool+i,&a,run,wargs+i)) $abort("worker start");
+    pthread_attr_destroy(&a);
+  }
 $msg("Server started");
   for(size_t i=0;i<threads_count;i++) pthread_join(tpool[i],0);
+// I/O threads still read database
+  pager_stop();
+  metrics_stop();
+  log_stop();
+  atomic_store(&ctl_stop,1);
+  writeone(ctl_fd);
+  pthread_join(ctl_thread,0);
+  close(ctl_fd);
+  ctl_fd=-1;
+  if(hfd>=0) close(hfd);
+  hfd=-1;
+  mlfd=-1;
+  for(size_t i=0;i<threads_count;i++) close(readers[i].efd);
+  md_free(readers);
+  readers=0;
+  metrics_free();
   md_free(tpool);
-  regfree(&rre1);
+  md_free(wargs);
   close(sfd); sconn.fd=sfd=-1;
-  close(lfd); lconn.fd=lfd=-1;
-
-  db_close(db);
-  db=0;
+  for(size_t i=0;i<lfds_count;i++) close(lfds[i]);
+  md_free(lfds);
+  lfds=0;
+  lfds_count=0;
+
+  v=atomic_load(&dbv);
+  if(c->heat_file) db_heat_save(v->db,c->heat_file);
+  db_close(v->db);
+  md_free(v);
+  atomic_store(&dbv,0);
 $msg("Server stopped");
   return 0;
 }
 
 
-static int listen_tcp4(const char *ip,uint16_t port,int backlog)
+static int listen_tcp4(const char *ip,uint16_t port,int backlog,int reuseport)
 {
   if(backlog<=0) backlog=BACKLOG;
 
@@ -152,6 +655,7 @@ static int listen_tcp4(const char *ip,uint16_t port,int backlog)
   int on = 1;
 
   if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))==-1) $abort("listen socket options");
+  if(reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))==-1) $abort("listen socket reuseport");
 
   struct sockaddr_in addr;
   memset(&addr, 0, sizeof(addr));
@@ -172,7 +676,7 @@ $msg("listen at http://%s:%hu",ip,port);
 }
 
 
-static int listen_unix(const char *path, int backlog)
+static int listen_unix(const char *path, int backlog, mode_t mode)
 {
     if(!path || !*path) $abort("empty path");
     if(backlog <= 0) backlog=BACKLOG;
@@ -191,7 +695,7 @@ static int listen_unix(const char *path, int backlog)
     memcpy(addr.sun_path,path,path_len+1);
     socklen_t len=(socklen_t)(offsetof(struct sockaddr_un, sun_path)+path_len+1);
     if(bind(fd, (struct sockaddr *)&addr, len)== -1) $abort("bind");
-    chmod(path, 0666);
+    chmod(path, mode);
     if(listen(fd, backlog)== -1) $abort("listen");
 
 $msg("listen at unix socket %s",path);
@@ -199,7 +703,19 @@ $msg("listen at unix socket %s",path);
 }
 
 
-static conn_t* incoming(const cfg_server_t* cfg,int efd)
+//! state of epoll worker
+typedef struct epoll_worker_t
+{
+  conn_pool_t pool;
+  wheel_t wheel;
+  metrics_t* m;
+  log_ring_t* log;		//!< 0 without request log
+  db_reader_t* reader;
+  pager_queue_t* pager;		//!< 0 without I/O threads
+  int epfd;
+} epoll_worker_t;
+
+static conn_t* incoming(epoll_worker_t* w,int lfd)
 {
   int f=-1;
   struct sockaddr_storage sa;
@@ -208,26 +724,27 @@ static conn_t* incoming(const cfg_server_t* cfg,int efd)
 
   if(f<0)
   {
-    if(!(errno == EAGAIN || errno == EWOULDBLOCK)) perror("accept");
+    if(!(errno == EAGAIN || errno == EWOULDBLOCK)) $msg("accept error: %m");
     return 0;
   }
 
-  conn_t* rv=md_new(rv);
+  conn_t* rv=conn_alloc(&w->pool,f);
   rv->type=CONN_SOCKET;
   rv->state=STATE_RECV;
-  rv->fd=f;
-  rv->buf=md_calloc(cfg->inbuf);
+  wheel_arm(&w->wheel,rv);
+  metrics_add(&w->m->accepted,1);
 
   struct epoll_event ev={0,};
   ev.data.ptr=rv;
   ev.events=EPOLLIN|EPOLLRDHUP|EPOLLERR;
-  epoll_ctl(efd,EPOLL_CTL_ADD,rv->fd,&ev);
+  epoll_ctl(w->epfd,EPOLL_CTL_ADD,rv->fd,&ev);
 
   return rv;
 }
 
 
-static int handle_signalfd(int sfd)
+//! pending signals of signalfd, 1 if one ends server
+int server_signal(int sfd)
 {
   for(;;)
   {
@@ -252,11 +769,14 @@ static int handle_signalfd(int sfd)
       case SIGTERM:
       case SIGINT:
       case SIGQUIT:
-//            atomic_store_explicit(&terminate, true, memory_order_relaxed);
+// other workers may not see signalfd readable any more
+        atomic_fetch_or(&ctrl_flags,CTRL_FLAG_SHUTDOWN);
+        for(size_t i=0;i<threads_count;i++) writeone(readers[i].efd);
         return 1;
 
       case SIGHUP:
-//            atomic_store_explicit(&reload, true, memory_order_relaxed);
+        atomic_fetch_or(&ctrl_flags,CTRL_FLAG_RELOAD);
+        writeone(ctl_fd);
         return 0;
 
       default:
@@ -266,88 +786,532 @@ static int handle_signalfd(int sfd)
   return 0;
 }
 
-static int handle_in(const cfg_server_t* cfg,conn_t* c,int efd)
+static int handle_in(const cfg_server_t* cfg,conn_t* c)
 {
   for(;;)
   {
+    if(conn_parse(cfg,c)) break;
     if(c->szin>=cfg->inbuf) return 1;
     ssize_t n=read(c->fd,c->buf+c->szin,cfg->inbuf-c->szin);
     if(!n) return 1;
     if(n<0)  return !(errno == EAGAIN || errno == EWOULDBLOCK);
+    if(!c->start) c->start=metrics_clock();
     c->szin+=(size_t)n;
+    ((char*)c->buf)[c->szin]=0;
+  }
 
-    void* line_end = memmem(c->buf,c->szin,"\r\n",2);
-    if(!line_end) continue;
+  return 0;
+}
 
-    size_t bs=0;
-    const void* b=content(c->buf,line_end-c->buf,&bs);
-    c->hdr=b? cfg->headers : cfg->h404;
-    c->hdr_sz=strlen(c->hdr);
-    c->hdr_sent=0;
-    c->body=b;
-    c->body_sz=b?bs:0;
-    c->body_sent=0;
-    c->state=STATE_SEND;
+//! tag of If-None-Match list matching stored one, len is 0 for *
+static const char* etag_match(const http_req_t* r,uint64_t etag,size_t* len)
+{
+  const char* p=r->inm;
+  const char* e=p+r->inm_len;
+  for(const char* t;(t=http_etag(&p,e,len));)
+  {
+    if(*len==1 && *t=='*')
+    {
+      *len=0;
+      return t;
+    }
+    if(db_etag(t,*len)==etag) return t;
+  }
+  return 0;
+}
 
-//? try to write immediately
+static inline void out_add(conn_t* c,const void* p,size_t len)
+{
+  if(len) c->iov[c->niov++]=(struct iovec){(void*)p,len};
+}
 
-    struct epoll_event ev={0,};
-    ev.data.ptr=c;
-    ev.events=EPOLLOUT|EPOLLRDHUP|EPOLLERR;
-    epoll_ctl(efd,EPOLL_CTL_MOD,c->fd,&ev);
-    break;
-  }
+//! formatted append to scratch, 0 if it does not fit
+static char* sprint(char* s,const char* se,const char* fmt,...)
+{
+  if(!s) return 0;
+  va_list ap;
+  va_start(ap,fmt);
+  int n=vsnprintf(s,se-s,fmt,ap);
+  va_end(ap);
+  return n>=0 && n<se-s ? s+n : 0;
+}
 
+//! value of stored header line or 0
+static const char* stored_header(const char* h,const char* e,const char* name,size_t* len)
+{
+  size_t nl=strlen(name);
+  for(const char* l=h;l<e;)
+  {
+    const char* le=memmem(l,e-l,"\r\n",2);
+    if(!le || le==l) break;
+    if(le-l>(ptrdiff_t)nl && !strncasecmp(l,name,nl))
+    {
+      for(l+=nl;l<le && *l==' ';l++);
+      *len=le-l;
+      return l;
+    }
+    l=le+2;
+  }
   return 0;
 }
 
-static int handle_out(const cfg_server_t* cfg,conn_t* c)
+//! stored header lines except Content-* to scratch
+static char* stored_filter(char* w,const char* se,const char* h,const char* e)
 {
-  while(c->hdr_sent<c->hdr_sz)
+  for(const char* l=h;w && l<e;)
   {
-    ssize_t n=write(c->fd,c->hdr+c->hdr_sent,c->hdr_sz-c->hdr_sent);
-    if(n<0)
-      return !(errno == EAGAIN || errno == EWOULDBLOCK);
-    c->hdr_sent+=(size_t)n;
+    const char* le=memmem(l,e-l,"\r\n",2);
+    if(!le || le==l) break;
+    if(strncasecmp(l,"Content-",8)) w=sprint(w,se,"%.*s\r\n",(int)(le-l),l);
+    l=le+2;
   }
+  return w;
+}
 
-  while(c->body_sent<c->body_sz)
+//! stored header lines a 304 repeats to scratch
+static char* stored_cache(char* w,const char* se,const char* h,const char* e)
+{
+  static const char* const names[]={"Cache-Control:","Expires:","Vary:","Content-Location:",0};
+  for(const char* l=h;l<e;)
   {
-    ssize_t n=write(c->fd,c->body+c->body_sent,c->body_sz-c->body_sent);
-    if(n<0)
-      return !(errno == EAGAIN || errno == EWOULDBLOCK);
-    c->body_sent+=(size_t)n;
+    const char* le=memmem(l,e-l,"\r\n",2);
+    if(!le || le==l) break;
+    for(const char* const* n=names;*n;n++)
+      if(!strncasecmp(l,*n,strlen(*n)))
+      {
+        char* p=sprint(w,se,"%.*s\r\n",(int)(le-l),l);
+        if(p) w=p;
+      }
+    l=le+2;
+  }
+  return w;
+}
+
+//! ETag line of 304 is the one 200 sends, matched tag if record has none, caching lines of stored header follow
+static void not_modified(const cfg_server_t* cfg,conn_t* c,const db_value_t* v,size_t head,const char* tag,size_t len)
+{
+  size_t sl;
+  const char* st=stored_header(v->data,v->data+head,"ETag:",&sl);
+  if(st)
+  {
+    tag=st;
+    len=sl;
+  }
+  else if(len>=2 && tag[0]=='W' && tag[1]=='/')
+  {
+    tag+=2;
+    len-=2;
+  }
+  char* w=c->scratch;
+// room for final empty line, lines that do not fit are left out
+  const char* se=w+CONN_SCRATCH-2;
+  char* p=len ? sprint(w,se,"ETag: %.*s\r\n",(int)len,tag) : 0;
+  if(p) w=p;
+  w=stored_cache(w,se,v->data,v->data+head);
+  w=mempcpy(w,"\r\n",2);
+  out_add(c,c->close ? cfg->h304_close : cfg->h304,strlen(c->close ? cfg->h304_close : cfg->h304));
+  out_add(c,c->scratch,w-c->scratch);
+}
+
+//! If-Range is absent or matches, else whole entity is sent, it needs strong match of entity tag, dates are not known
+static int if_range(const http_req_t* q,const db_value_t* v)
+{
+  return !q->ifr || (v->etag && !(q->ifr_len>=2 && q->ifr[0]=='W') && db_etag(q->ifr,q->ifr_len)==v->etag);
+}
+
+//! Range of GET, status or 0 if whole record is sent instead
+static int ranges(const cfg_server_t* cfg,conn_t* c,const db_value_t* v,size_t head)
+{
+  const http_req_t* q=&c->req;
+  if(!if_range(q,v)) return 0;
+
+  const char* d=v->data;
+  const char* body=d+head;
+  uint64_t size=v->len-head;
+  http_range_t r[CONN_RANGES];
+  int n=http_range(q->range,q->range_len,size,r,CONN_RANGES);
+  if(n<0) return 0;
+
+  char* w=c->scratch;
+  const char* se=w+CONN_SCRATCH;
+  if(!n)
+  {
+    const char* h=c->close ? cfg->h416_close : cfg->h416;
+    out_add(c,h,strlen(h));
+    w=sprint(w,se,"Content-Range: bytes */%lu\r\nContent-Length: 0\r\n\r\n",size);
+    out_add(c,c->scratch,w-c->scratch);
+    return 416;
+  }
+
+// stored Content-Length is first line, it is replaced by length of ranges
+  const char* sh=d;
+  if(head>15 && !strncasecmp(d,"Content-Length:",15)) sh=memmem(d,head,"\r\n",2)+2;
+
+  if(n==1)
+  {
+    uint64_t len=r->last-r->first+1;
+    w=sprint(w,se,"Content-Range: bytes %lu-%lu/%lu\r\nContent-Length: %lu\r\n",r->first,r->last,size,len);
+    const char* h=c->close ? cfg->h206_close : cfg->h206;
+    out_add(c,h,strlen(h));
+    out_add(c,c->scratch,w-c->scratch);
+    out_add(c,sh,body-sh);
+    out_add(c,body+r->first,len);
+    if(cfg->sendfile>0 && len>=(size_t)cfg->sendfile && v->fd>=0)
+    {
+      c->body_fd=v->fd;
+      c->body_off=v->off+head+r->first;
+    }
+    return 206;
+  }
+
+// part headers first, their length is part of total
+  size_t ctl=0;
+  const char* ct=stored_header(sh,body,"Content-Type:",&ctl);
+  if(!ct && cfg->ctype)
+  {
+    ct=cfg->ctype;
+    ctl=strlen(ct);
+  }
+  char bnd[24];
+  snprintf(bnd,sizeof(bnd),"0decca%016lx",v->etag^v->off);
+  c->niov=2;
+  uint64_t total=0;
+  for(int i=0;i<n && w;i++)
+  {
+    char* p=w;
+    w=sprint(w,se,"\r\n--%s\r\n",bnd);
+    if(ct) w=sprint(w,se,"Content-Type: %.*s\r\n",(int)ctl,ct);
+    w=sprint(w,se,"Content-Range: bytes %lu-%lu/%lu\r\n\r\n",r[i].first,r[i].last,size);
+    if(!w) break;
+    out_add(c,p,w-p);
+    out_add(c,body+r[i].first,r[i].last-r[i].first+1);
+    total+=w-p+r[i].last-r[i].first+1;
+  }
+  char* p=w;
+  w=sprint(w,se,"\r\n--%s--\r\n",bnd);
+  if(w)
+  {
+    out_add(c,p,w-p);
+    total+=w-p;
+  }
+  p=w;
+  w=sprint(w,se,"Content-Type: multipart/byteranges; boundary=%s\r\nContent-Length: %lu\r\n",bnd,total);
+  w=stored_filter(w,se,sh,body);
+  w=sprint(w,se,"\r\n");
+// headers do not fit in scratch
+  if(!w)
+  {
+    c->niov=0;
+    return 0;
+  }
+  const char* h=c->close ? cfg->h206m_close : cfg->h206m;
+  c->iov[0]=(struct iovec){(void*)h,strlen(h)};
+  c->iov[1]=(struct iovec){p,w-p};
+  return 206;
+}
+
+//! response pieces of looked up value, returns HTTP status
+static int respond(const cfg_server_t* cfg,conn_t* c,const db_value_t* v)
+{
+  size_t head=v->data ? head_len(v) : 0;
+  if(!head)
+  {
+    const char* h=c->close ? cfg->h404_close : cfg->h404;
+    out_add(c,h,strlen(h));
+    return 404;
+  }
+
+  const char* tag;
+  size_t tl;
+  if(v->etag && c->req.inm && (tag=etag_match(&c->req,v->etag,&tl)))
+  {
+    not_modified(cfg,c,v,head,tag,tl);
+    return 304;
+  }
+  int st;
+  if(c->req.method==HTTP_GET && c->req.range && (st=ranges(cfg,c,v,head))) return st;
+
+  size_t bs=c->req.method==HTTP_HEAD ? head : v->len;
+  const char* h=c->close ? cfg->headers_close : cfg->headers;
+  out_add(c,h,strlen(h));
+  out_add(c,v->data,bs);
+  if(cfg->sendfile>0 && bs>=(size_t)cfg->sendfile && v->fd>=0)
+  {
+    c->body_fd=v->fd;
+    c->body_off=v->off;
+  }
+  return 200;
+}
+
+int conn_respond(const cfg_server_t* cfg,conn_t* c,const db_value_t* v)
+{
+  c->niov=0;
+  c->cur=0;
+  c->body_fd=-1;
+  c->sent=0;
+  c->state=STATE_SEND;
+  return c->status=respond(cfg,c,v);
+}
+
+_Static_assert(CONN_RANGES<DB_WINDOW,"db_window_t holds stored headers and all ranges");
+
+//! bytes of value response reads, 0 if it reads none, whole value if stored header length is unknown
+static int conn_window(const conn_t* c,const db_value_t* v,db_window_t* w)
+{
+  const http_req_t* q=&c->req;
+  size_t tl;
+  if(!v->data || (v->etag && q->inm && etag_match(q,v->etag,&tl))) return 0;
+  w->n=1;
+  w->r[0]=0;
+  w->r[1]=v->len;
+  if(!v->head) return 1;
+  if(q->method==HTTP_HEAD)
+  {
+    w->r[1]=v->head;
+    return 1;
+  }
+  if(!q->range || !if_range(q,v)) return 1;
+
+  http_range_t r[CONN_RANGES];
+  int n=http_range(q->range,q->range_len,v->len-v->head,r,CONN_RANGES);
+  if(n<0) return 1;
+  if(!n) return 0;
+  w->r[1]=v->head;
+  for(int i=0;i<n;i++)
+  {
+    w->r[2*w->n]=v->head+r[i].first;
+    w->r[2*w->n+1]=v->head+r[i].last+1;
+    w->n++;
+  }
+  return 1;
+}
+
+//! value not in memory goes to I/O thread, worker answers it when it comes back, value failing deferred check turns into miss
+int conn_page(pager_queue_t* q,db_reader_t* r,conn_t* c,db_value_t* v)
+{
+  db_window_t w;
+  if(!q || !conn_window(c,v,&w) || db_value_resident(r->db,v,&w)) return 0;
+  if(!pager_submit(q,c,r->db,v,&w))
+  {
+// full queue, worker takes the faults and the deferred check itself
+    if(db_value_load(r->db,v,&w)) v->data=0;
+    return 0;
+  }
+  c->val=*v;
+  c->state=STATE_PAGE;
+  reader_hold(r,c);
+  return 1;
+}
+
+//! n bytes of response are sent, 1 if it is complete
+int conn_sent(conn_t* c,size_t n)
+{
+  c->sent+=n;
+  for(;c->cur<c->niov;c->cur++)
+  {
+    struct iovec* o=c->iov+c->cur;
+    size_t k=n<o->iov_len ? n : o->iov_len;
+    o->iov_base+=k;
+    o->iov_len-=k;
+    n-=k;
+    if(c->body_fd>=0 && c->cur==c->niov-1) c->body_off+=k;
+    if(o->iov_len) return 0;
+  }
+  return 1;
+}
+
+//! pieces go in one writev, or are corked before sendfile of last one
+static ssize_t send_some(conn_t* c)
+{
+  size_t n=c->niov-c->cur;
+  if(c->body_fd<0) return writev(c->fd,c->iov+c->cur,n);
+  if(n==1) return sendfile(c->fd,c->body_fd,&(off_t){c->body_off},c->iov[c->cur].iov_len);
+  struct msghdr m={.msg_iov=c->iov+c->cur,.msg_iovlen=n-1};
+  return sendmsg(c->fd,&m,MSG_MORE|MSG_NOSIGNAL);
+}
+
+static void conn_events(conn_t* c,int efd,uint32_t events)
+{
+  struct epoll_event ev={0,};
+  ev.data.ptr=c;
+  ev.events=events|EPOLLRDHUP|EPOLLERR;
+  epoll_ctl(efd,EPOLL_CTL_MOD,c->fd,&ev);
+}
+
+//! EPOLLOUT is armed only when socket buffer is full
+static int handle_out(epoll_worker_t* w,const cfg_server_t* cfg,conn_t* c)
+{
+  while(c->cur<c->niov)
+  {
+    ssize_t n=send_some(c);
+    if(n<0) goto again;
+// sendfile past end of truncated file makes no progress
+    if(!n) return 1;
+    conn_sent(c,n);
+    metrics_add(&w->m->bytes,n);
+  }
+
+  uint64_t us=metrics_done(w->m,c->start);
+  if(w->log) log_request(w->log,c,us);
+  reader_release(w->reader,c);
+  if(c->out)
+  {
+    conn_events(c,w->epfd,EPOLLIN);
+    c->out=0;
   }
+  conn_next(cfg,c);
+  return 0;
 
-//$msg("close");
-  c->state=STATE_CLOSE;
+again:
+  if(!(errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+  metrics_add(&w->m->partial,1);
+  if(!c->out)
+  {
+    conn_events(c,w->epfd,EPOLLOUT);
+    c->out=1;
+  }
   return 0;
 }
 
 
-static void* worker(void* arg)
+static void conn_free(epoll_worker_t* w,conn_t* c)
+{
+  wheel_cancel(&w->wheel,c);
+  reader_release(w->reader,c);
+  epoll_ctl(w->epfd,EPOLL_CTL_DEL,c->fd,0);
+  close(c->fd);
+  conn_release(&w->pool,c);
+  metrics_add(&w->m->closed,1);
+}
+
+//! values paged in by I/O threads are answered, pipelined requests go to lookup
+static void epoll_paged(epoll_worker_t* w,const cfg_server_t* cfg,conn_t** pend,size_t* np)
+{
+  pager_done_t d[64];
+  size_t n;
+  while((n=pager_done(w->pager,d,64)))
+    for(size_t i=0;i<n;i++)
+    {
+      conn_t* c=d[i].c;
+      if(d[i].rv) c->val.data=0;
+      struct epoll_event ev={.events=EPOLLIN|EPOLLRDHUP|EPOLLERR,.data.ptr=c};
+      epoll_ctl(w->epfd,EPOLL_CTL_ADD,c->fd,&ev);
+      metrics_response(w->m,conn_respond(cfg,c,&c->val));
+      if(handle_out(w,cfg,c)) c->state=STATE_CLOSE;
+      if(c->state==STATE_LOOKUP) pend[(*np)++]=c;
+      else if(c->state==STATE_CLOSE) conn_free(w,c);
+      else wheel_arm(&w->wheel,c);
+    }
+}
+
+//! idle connections are marked, ones still idle since last sweep end, others get next answer with close
+static void epoll_sweep(epoll_worker_t* w)
+{
+  for(size_t i=0;i<w->pool.nfds;i++)
+  {
+    conn_t* c=w->pool.fds[i];
+    if(!c || c->type!=CONN_SOCKET || c->state!=STATE_RECV || c->start) continue;
+    if(c->close) conn_free(w,c);
+    else c->close=1;
+  }
+}
+
+//! idle, slow header or stalled reader, reset drops unsent data at once
+static void conn_expire(void* arg,conn_t* c)
+{
+  epoll_worker_t* w=arg;
+  metrics_add(&w->m->timeouts,1);
+  struct linger l={1,0};
+  setsockopt(c->fd,SOL_SOCKET,SO_LINGER,&l,sizeof(l));
+  conn_free(arg,c);
+}
+
+//! connections still sending from generations before g are reset, as if their deadline passed
+static void epoll_cut(epoll_worker_t* w,uint64_t g)
+{
+  for(size_t i=0;i<w->pool.nfds;i++)
+  {
+    conn_t* c=w->pool.fds[i];
+    if(c && c->type==CONN_SOCKET && c->state==STATE_SEND && c->gen && c->gen<g) conn_expire(w,c);
+  }
+}
+
+//! lookups of all ready requests are interleaved, found values are sampled into heat map
+//! paths are read as z/x/y by database of the round, request may be parsed before reload
+void conn_lookup(db_reader_t* r,conn_t** pend,size_t np,const char** keys,size_t* lens,db_value_t* vals)
 {
-  const cfg_server_t* cfg=arg;
-  conn_t* root=0;
+  db_t* db=r->db;
+  if(db_is_tiles(db))
+  {
+    for(size_t i=0;i<np;i++)
+    {
+      const conn_t* c=pend[i];
+      unsigned z;
+      uint64_t x,y;
+      if(db_tile_parse(c->req.path,c->req.plen,&z,&x,&y) || db_get_tile_value(db,z,x,y,vals+i)) vals[i].data=0;
+    }
+  }
+  else
+  {
+    for(size_t i=0;i<np;i++)
+    {
+      keys[i]=pend[i]->req.path;
+      lens[i]=pend[i]->req.plen;
+    }
+    db_get_batch(db,keys,lens,np,vals);
+  }
+  db_heat(db,&r->heat,vals,np);
+}
 
-  int epfd = epoll_create1(EPOLL_CLOEXEC);
+static void* worker(void* arg)
+{
+  const worker_arg_t* w=arg;
+  const cfg_server_t* cfg=w->cfg;
+  epoll_worker_t ew;
+  conn_pool_init(&ew.pool,cfg->inbuf);
+  wheel_init(&ew.wheel,cfg->timeout);
+  ew.m=metrics_worker(w->id);
+  ew.m->tid=gettid();
+  ew.log=log_worker(w->id);
+  ew.reader=w->reader;
+  ew.pager=pager_worker(w->id);
+  conn_t wconn={.type=CONN_WAKE,.fd=w->reader->efd};
+  conn_t lconn={.type=CONN_LISTEN,.fd=w->lfd};
+  int draining=0;
+  uint64_t swept=0;			//!< ms of last idle sweep while draining
+
+  int epfd=ew.epfd=epoll_create1(EPOLL_CLOEXEC);
   if(epfd<0) $abort("epoll creating error");
 
 
   struct epoll_event ev;
   ev.events=EPOLLIN|EPOLLERR|EPOLLEXCLUSIVE;
   ev.data.ptr=&lconn;
-  epoll_ctl(epfd,EPOLL_CTL_ADD,lfd,&ev);
+  epoll_ctl(epfd,EPOLL_CTL_ADD,lconn.fd,&ev);
 
   ev.events=EPOLLIN|EPOLLERR;
   ev.data.ptr=&sconn;
   epoll_ctl(epfd,EPOLL_CTL_ADD,sfd,&ev);
+  ev.data.ptr=&wconn;
+  epoll_ctl(epfd,EPOLL_CTL_ADD,wconn.fd,&ev);
 
+// paged in values come back in addition to ready requests
+  size_t npmax=cfg->backlog+(ew.pager ? PAGER_DEPTH : 0);
   struct epoll_event *events=md_tcalloc(struct epoll_event,cfg->backlog);
+  conn_t** pend=md_pcalloc(npmax);
+  const char** keys=md_pcalloc(npmax);
+  size_t* lens=md_tcalloc(size_t,npmax);
+  db_value_t* vals=md_tcalloc(db_value_t,npmax);
 
-  for(;;)
+  while(!(atomic_load(&ctrl_flags)&CTRL_FLAG_SHUTDOWN))
   {
-    int n=epoll_wait(epfd,events,cfg->backlog,-1);
+// wakeups for deadlines only while connections wait
+    int tmo=ew.wheel.count ? 1<<ew.wheel.shift : -1;
+    if(draining && (tmo<0 || tmo>DRAIN_IDLE_MS)) tmo=DRAIN_IDLE_MS;
+    int n=epoll_wait(epfd,events,cfg->backlog,tmo);
+    size_t np=0;
+    wheel_now(&ew.wheel);
+    reader_enter(ew.reader);
 
     if(n<0 && errno!=EINTR)
     {
@@ -361,55 +1325,104 @@ static void* worker(void* arg)
       switch(c->type)
       {
         case CONN_LISTEN:
-          {
-            conn_t* z=incoming(cfg,epfd);
-
-            if(!z) continue;
-#if LOCALDEBUG
-            conn_t* t=0;
-            HASH_FIND(hh,root,&z->fd,sizeof(z->fd),t);
-            if(t) $abort("integrity failed");
-#endif
-            HASH_ADD_KEYPTR(hh,root,&z->fd,sizeof(z->fd),z);
-          }
+// backlog is drained on each wakeup
+          if(!draining) while(incoming(&ew,c->fd));
           continue;
         case CONN_SIGNAL:
-          $msg("got signal, exiting");
-          if(!handle_signalfd(sfd)) continue;
-          atomic_fetch_or(&ctrl_flags,CTRL_FLAG_SHUTDOWN);
-          break;
+          $msg("got signal");
+          server_signal(sfd);
+          continue;
+// new database generation, shutdown or paged in values
+        case CONN_WAKE:
+        {
+          uint64_t x;
+          read(c->fd,&x,sizeof(x));
+          if(ew.pager) epoll_paged(&ew,cfg,pend,&np);
+          continue;
+        }
         default:
         {
 //          if(evmask&(EPOLLERR|EPOLLHUP|EPOLLRDHUP)) c->state=STATE_CLOSE;
           if(evmask&EPOLLERR) c->state=STATE_CLOSE;
           else
           {
-            if((evmask&EPOLLIN) && c->state==STATE_RECV && handle_in(cfg,c,epfd)) c->state=STATE_CLOSE;
-            if(c->state==STATE_SEND && handle_out(cfg,c)) c->state=STATE_CLOSE;
-          }
-          if(c->state==STATE_CLOSE)
-          {
-            epoll_ctl(epfd,EPOLL_CTL_DEL,c->fd,0);
-            close(c->fd);
-            HASH_DELETE(hh,root,c);
-            md_free(c->buf);
-            md_free(c);
+            if((evmask&EPOLLIN) && c->state==STATE_RECV && handle_in(cfg,c)) c->state=STATE_CLOSE;
+            if(c->state==STATE_LOOKUP)
+            {
+              pend[np++]=c;
+              continue;
+            }
+// send deadline moves with progress, partial requests do not move receive deadline
+            if(c->state==STATE_SEND)
+            {
+              size_t sent=c->sent;
+              if(handle_out(&ew,cfg,c)) c->state=STATE_CLOSE;
+              else if(c->state!=STATE_SEND || c->sent!=sent) wheel_arm(&ew.wheel,c);
+            }
+            if(c->state==STATE_LOOKUP)
+            {
+              pend[np++]=c;
+              continue;
+            }
           }
+          if(c->state==STATE_CLOSE) conn_free(&ew,c);
+        }
+      }
+    }
+
+// pipelined requests found in buffer after response are looked up again in this round
+    while(np)
+    {
+      conn_lookup(ew.reader,pend,np,keys,lens,vals);
+      size_t nq=0;
+      for(size_t i=0;i<np;i++)
+      {
+        conn_t* c=pend[i];
+// events and deadline are off while value is paged in
+        if(conn_page(ew.pager,ew.reader,c,vals+i))
+        {
+          wheel_cancel(&ew.wheel,c);
+          epoll_ctl(epfd,EPOLL_CTL_DEL,c->fd,0);
+          metrics_add(&ew.m->paged,1);
+          continue;
         }
+        metrics_response(ew.m,conn_respond(cfg,c,vals+i));
+        reader_hold(ew.reader,c);
+        if(handle_out(&ew,cfg,c)) c->state=STATE_CLOSE;
+        if(c->state==STATE_LOOKUP) pend[nq++]=c;
+        else if(c->state==STATE_CLOSE) conn_free(&ew,c);
+        else wheel_arm(&ew.wheel,c);
       }
+      np=nq;
+    }
+    wheel_expire(&ew.wheel,conn_expire,&ew);
+    uint64_t g=reader_cut(ew.reader);
+    if(g) epoll_cut(&ew,g);
+    reader_leave(ew.reader);
+    if(!draining && (atomic_load(&ctrl_flags)&CTRL_FLAG_DRAIN))
+    {
+// listener is left to new instance
+      draining=1;
+      epoll_ctl(epfd,EPOLL_CTL_DEL,lconn.fd,0);
+      swept=0;
     }
+    if(draining && ew.wheel.now-swept>=DRAIN_IDLE_MS)
+    {
+      epoll_sweep(&ew);
+      swept=ew.wheel.now;
+    }
+    if(draining && !ew.pool.live) break;
   }
   close(epfd);
   md_free(events);
-
-  while(root)
-  {
-    conn_t* r=root;
-    HASH_DELETE(hh,root,r);
-    close(r->fd);
-    md_free(r->buf);
-    md_free(r);
-  }
+  md_free(pend);
+  md_free(keys);
+  md_free(lens);
+  md_free(vals);
+
+  for(size_t i=0;i<ew.pool.nfds;i++)
+    if(ew.pool.fds[i]) close(i);
+  conn_pool_free(&ew.pool);
 
   return 0;
 }
@@ -1,4 +1,10 @@
 
+#define SERVER_BACKEND_EPOLL	0
+#define SERVER_BACKEND_URING	1	//!< needs build with URING=1
+
+#define SERVER_STEER_NONE	0
+#define SERVER_STEER_CPU	1	//!< SO_INCOMING_CPU of listener is core of its worker
+#define SERVER_STEER_BPF	2	//!< reuseport group program selects listener by receiving core
 
 struct cfg_server_t;
 
@@ -0,0 +1,584 @@
+#if USE_URING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <liburing.h>
+
+#include "macros.h"
+#include "server.h"
+#include "db.h"
+#include "cfg.h"
+#include "http.h"
+#include "conn.h"
+#include "metrics.h"
+#include "log.h"
+#include "pager.h"
+
+//! \file
+//! io_uring worker: multishot accept into registered files, recv from provided buffer ring while connection has room to hold,
+//! header and record leave in one sendmsg (zero copy from mmap for large bodies), close is linked to last send
+
+#define URING_FILES	4096		//!< registered file slots, connections per worker
+#define URING_BUFS	1024		//!< provided recv buffers per worker, power of 2
+#define URING_BGID	0
+
+//! user data is connection pointer with operation in low bits
+typedef enum uring_op_t
+{
+  OP_ACCEPT=0,
+  OP_SIGNAL,
+  OP_RECV,
+  OP_SEND,
+  OP_SHUTDOWN,
+  OP_CLOSE,
+  OP_TIMER,
+  OP_WAKE,
+  OP_CANCEL,
+  OP_DRAIN
+} uring_op_t;
+
+//! connection slots are cache line aligned
+#define OP_MASK	15ull
+
+typedef struct uring_t
+{
+  struct io_uring ring;
+  struct io_uring_buf_ring* br;
+  char* bufs;
+  size_t bsz;
+  const cfg_server_t* cfg;
+  int lfd;
+  int tfd;			//!< timerfd ticking timer wheel, -1 without timeout
+  conn_pool_t pool;
+  wheel_t wheel;
+  metrics_t* m;
+  log_ring_t* log;		//!< 0 without request log
+  db_reader_t* reader;
+  pager_queue_t* pager;		//!< 0 without I/O threads
+  conn_t* starved;		//!< connections whose recv found buffer ring empty, oldest first
+  conn_t** stail;
+  size_t recycled;		//!< buffers returned since starved connections were armed
+  int draining;			//!< accept is cancelled, listener belongs to new instance
+  int paused;			//!< accept ended on full file table, armed again when a connection is freed
+  time_t logged;		//!< last accept error report
+  size_t errors;		//!< accept errors since last report
+  struct __kernel_timespec sweep;	//!< period of idle sweeps while draining
+} uring_t;
+
+static struct io_uring_sqe* sqe_get(uring_t* u,conn_t* c,uring_op_t op)
+{
+  struct io_uring_sqe* s=io_uring_get_sqe(&u->ring);
+  if(!s)
+  {
+    io_uring_submit(&u->ring);
+    s=io_uring_get_sqe(&u->ring);
+    if(!s) $abort("io_uring submission queue");
+  }
+  io_uring_sqe_set_data64(s,(uintptr_t)c|op);
+  if(c) c->pending++;
+  return s;
+}
+
+//! linked requests must not be split between submissions
+static void sqe_reserve(uring_t* u,unsigned n)
+{
+  if(io_uring_sq_space_left(&u->ring)<n) io_uring_submit(&u->ring);
+}
+
+static void arm_accept(uring_t* u)
+{
+  io_uring_prep_multishot_accept_direct(sqe_get(u,0,OP_ACCEPT),u->lfd,0,0,0);
+}
+
+static void arm_signal(uring_t* u)
+{
+  io_uring_prep_poll_multishot(sqe_get(u,0,OP_SIGNAL),sfd,POLLIN);
+}
+
+static void arm_timer(uring_t* u)
+{
+  io_uring_prep_poll_multishot(sqe_get(u,0,OP_TIMER),u->tfd,POLLIN);
+}
+
+static void arm_wake(uring_t* u)
+{
+  io_uring_prep_poll_multishot(sqe_get(u,0,OP_WAKE),u->reader->efd,POLLIN);
+}
+
+//! one buffer per recv, connection holding CONN_HOLD of them stops reading and the peer is held back by its window
+static void arm_recv(uring_t* u,conn_t* c)
+{
+  struct io_uring_sqe* s=sqe_get(u,c,OP_RECV);
+  io_uring_prep_recv(s,c->fd,0,0,0);
+  s->flags|=IOSQE_FIXED_FILE|IOSQE_BUFFER_SELECT;
+  s->buf_group=URING_BGID;
+  c->recv=1;
+}
+
+static void recv_next(uring_t* u,conn_t* c)
+{
+  if(!c->recv && !c->sprev && c->state!=STATE_CLOSE && c->nhold<CONN_HOLD) arm_recv(u,c);
+}
+
+static void buf_recycle(uring_t* u,uint16_t bid)
+{
+  io_uring_buf_ring_add(u->br,u->bufs+(size_t)bid*u->bsz,u->bsz,bid,io_uring_buf_ring_mask(URING_BUFS),0);
+  io_uring_buf_ring_advance(u->br,1);
+  u->recycled++;
+}
+
+static void starve(uring_t* u,conn_t* c)
+{
+  c->snext=0;
+  c->sprev=u->stail;
+  *u->stail=c;
+  u->stail=&c->snext;
+}
+
+static void unstarve(uring_t* u,conn_t* c)
+{
+  if(!c->sprev) return;
+  *c->sprev=c->snext;
+  if(c->snext) c->snext->sprev=c->sprev;
+  else u->stail=c->sprev;
+  c->sprev=0;
+  c->snext=0;
+}
+
+//! starved connections get recv armed again, one per returned buffer, in order they ran out
+static void uring_unstarve(uring_t* u)
+{
+  while(u->starved && u->recycled)
+  {
+    conn_t* c=u->starved;
+    unstarve(u,c);
+    recv_next(u,c);
+    u->recycled--;
+  }
+  u->recycled=0;
+}
+
+//! shutdown ends armed recv, close releases registered slot; hard links survive failed send
+static void close_chain(uring_t* u,conn_t* c)
+{
+  struct io_uring_sqe* s=sqe_get(u,c,OP_SHUTDOWN);
+  io_uring_prep_shutdown(s,c->fd,SHUT_RDWR);
+  s->flags|=IOSQE_FIXED_FILE|IOSQE_IO_HARDLINK;
+  io_uring_prep_close_direct(sqe_get(u,c,OP_CLOSE),c->fd);
+}
+
+static void conn_close(uring_t* u,conn_t* c)
+{
+  if(c->state==STATE_CLOSE) return;
+  c->state=STATE_CLOSE;
+  wheel_cancel(&u->wheel,c);
+  sqe_reserve(u,2);
+  close_chain(u,c);
+}
+
+static void conn_free(uring_t* u,conn_t* c)
+{
+  wheel_cancel(&u->wheel,c);
+  unstarve(u,c);
+  reader_release(u->reader,c);
+  for(uint32_t i=0;i<c->nhold;i++) buf_recycle(u,c->hold[i]);
+  conn_release(&u->pool,c);
+  metrics_add(&u->m->closed,1);
+// file slot of connection is free again
+  if(u->paused && !u->draining)
+  {
+    u->paused=0;
+    arm_accept(u);
+  }
+}
+
+//! idle, slow header or stalled reader, shutdown fails send in flight
+static void conn_expire(void* arg,conn_t* c)
+{
+  uring_t* u=arg;
+  metrics_add(&u->m->timeouts,1);
+  conn_close(u,c);
+}
+
+//! idle connections are marked, ones still idle since last sweep are closed, others get next answer with close
+static void uring_sweep(uring_t* u)
+{
+  for(size_t i=0;i<u->pool.nfds;i++)
+  {
+    conn_t* c=u->pool.fds[i];
+    if(!c || c->state!=STATE_RECV || c->start || c->nhold) continue;
+    if(c->close) conn_close(u,c);
+    else c->close=1;
+  }
+  io_uring_prep_timeout(sqe_get(u,0,OP_DRAIN),&u->sweep,0,0);
+}
+
+//! connections still sending from generations before g are closed, as if their deadline passed
+static void uring_cut(uring_t* u,uint64_t g)
+{
+  for(size_t i=0;i<u->pool.nfds;i++)
+  {
+    conn_t* c=u->pool.fds[i];
+    if(c && c->state==STATE_SEND && c->gen && c->gen<g) conn_expire(u,c);
+  }
+}
+
+//! listener is left to new instance
+static void uring_drain(uring_t* u)
+{
+  u->draining=1;
+  u->sweep=(struct __kernel_timespec){0,DRAIN_IDLE_MS*1000000ll};
+  io_uring_prep_cancel64(sqe_get(u,0,OP_CANCEL),OP_ACCEPT,0);
+  uring_sweep(u);
+}
+
+//! held buffers are copied to input buffer as far as it has room
+static void conn_feed(uring_t* u,conn_t* c)
+{
+  size_t room=u->cfg->inbuf-c->szin;
+  while(c->nhold && room)
+  {
+    size_t k=c->hold_len[0]-c->hold_off;
+    if(k>room) k=room;
+    memcpy(c->buf+c->szin,u->bufs+(size_t)c->hold[0]*u->bsz+c->hold_off,k);
+    c->szin+=k;
+    room-=k;
+    c->hold_off+=k;
+    if(c->hold_off<c->hold_len[0]) break;
+    buf_recycle(u,c->hold[0]);
+    c->nhold--;
+    memmove(c->hold,c->hold+1,c->nhold*sizeof(c->hold[0]));
+    memmove(c->hold_len,c->hold_len+1,c->nhold*sizeof(c->hold_len[0]));
+    c->hold_off=0;
+  }
+  ((char*)c->buf)[c->szin]=0;
+  recv_next(u,c);
+}
+
+//! connection waiting for request goes to lookup when one is complete
+static void conn_ready(uring_t* u,conn_t* c,conn_t** pend,size_t* np)
+{
+  conn_feed(u,c);
+  if(c->state!=STATE_RECV) return;
+  if(conn_parse(u->cfg,c)) pend[(*np)++]=c;
+  else if(c->szin>=(size_t)u->cfg->inbuf) conn_close(u,c);
+}
+
+//! rest of response in one sendmsg, Connection: close adds shutdown and close to the chain
+static void conn_send(uring_t* u,conn_t* c)
+{
+  memset(&c->msg,0,sizeof(c->msg));
+  c->msg.msg_iov=c->iov+c->cur;
+  c->msg.msg_iovlen=c->niov-c->cur;
+
+  wheel_arm(&u->wheel,c);
+  sqe_reserve(u,c->close ? 3 : 1);
+  struct io_uring_sqe* s=sqe_get(u,c,OP_SEND);
+// large body marked for sendfile goes zero copy
+  if(c->body_fd>=0) io_uring_prep_sendmsg_zc(s,c->fd,&c->msg,MSG_WAITALL|MSG_NOSIGNAL);
+  else io_uring_prep_sendmsg(s,c->fd,&c->msg,MSG_WAITALL|MSG_NOSIGNAL);
+  s->flags|=IOSQE_FIXED_FILE;
+  if(!c->close) return;
+  s->flags|=IOSQE_IO_HARDLINK;
+  c->state=STATE_CLOSE;
+  close_chain(u,c);
+}
+
+//! values paged in by I/O threads are sent, connections closed meanwhile are freed
+static void uring_paged(uring_t* u)
+{
+  pager_done_t d[64];
+  size_t n;
+  while((n=pager_done(u->pager,d,64)))
+    for(size_t i=0;i<n;i++)
+    {
+      conn_t* c=d[i].c;
+      c->pending--;
+      if(c->state==STATE_CLOSE)
+      {
+        if(!c->pending) conn_free(u,c);
+        continue;
+      }
+      if(d[i].rv) c->val.data=0;
+      metrics_response(u->m,conn_respond(u->cfg,c,&c->val));
+      conn_send(u,c);
+    }
+}
+
+//! accept errors are reported at most once a second
+static void accept_error(uring_t* u,int err)
+{
+  u->errors++;
+  time_t t=time(0);
+  if(t==u->logged) return;
+  errno=err;
+  $msg("accept error: %m, %zu since last report",u->errors);
+  u->logged=t;
+  u->errors=0;
+}
+
+static void on_accept(uring_t* u,const struct io_uring_cqe* e)
+{
+  int ended=!(e->flags&IORING_CQE_F_MORE) && !u->draining;
+// full file table would fail again at once, accept waits for conn_free
+  if(e->res==-ENFILE && ended) u->paused=1;
+  else if(ended) arm_accept(u);
+  if(e->res<0)
+  {
+    if(e->res!=-ECANCELED) accept_error(u,-e->res);
+    return;
+  }
+
+  conn_t* c=conn_alloc(&u->pool,e->res);
+  c->type=CONN_SOCKET;
+  c->state=STATE_RECV;
+  wheel_arm(&u->wheel,c);
+  arm_recv(u,c);
+  metrics_add(&u->m->accepted,1);
+}
+
+//! held buffer is fed when input buffer has room, feeding arms next recv
+static void on_recv(uring_t* u,conn_t* c,const struct io_uring_cqe* e,conn_t** pend,size_t* np)
+{
+  c->recv=0;
+  if(e->res>0 && (e->flags&IORING_CQE_F_BUFFER))
+  {
+    uint16_t bid=e->flags>>IORING_CQE_BUFFER_SHIFT;
+    if(c->state==STATE_CLOSE)
+    {
+      buf_recycle(u,bid);
+      return;
+    }
+    c->hold[c->nhold]=bid;
+    c->hold_len[c->nhold++]=e->res;
+    if(!c->start) c->start=metrics_clock();
+  }
+  else if(e->res==-ENOBUFS && c->state!=STATE_CLOSE)
+  {
+    starve(u,c);
+    return;
+  }
+  else
+  {
+    conn_close(u,c);
+    return;
+  }
+  conn_ready(u,c,pend,np);
+}
+
+static void on_send(uring_t* u,conn_t* c,const struct io_uring_cqe* e,conn_t** pend,size_t* np)
+{
+  if(e->flags&IORING_CQE_F_NOTIF) return;
+// response with Connection: close is complete here too, its chain closes connection
+  int done=e->res>=0 && conn_sent(c,e->res);
+  if(e->res>0) metrics_add(&u->m->bytes,e->res);
+  if(done)
+  {
+    uint64_t us=metrics_done(u->m,c->start);
+    if(u->log) log_request(u->log,c,us);
+    reader_release(u->reader,c);
+  }
+  if(c->state==STATE_CLOSE) return;
+  if(e->res<0 || (!done && !e->res))
+  {
+    conn_close(u,c);
+    return;
+  }
+  if(!done)
+  {
+    metrics_add(&u->m->partial,1);
+    conn_send(u,c);
+    return;
+  }
+  wheel_arm(&u->wheel,c);
+  conn_next(u->cfg,c);
+  if(c->state==STATE_LOOKUP)
+  {
+    conn_feed(u,c);
+    pend[(*np)++]=c;
+  }
+  else conn_ready(u,c,pend,np);
+}
+
+void* worker_uring(void* arg)
+{
+  const worker_arg_t* w=arg;
+  const cfg_server_t* cfg=w->cfg;
+  uring_t u={0,};
+  u.cfg=cfg;
+  u.lfd=w->lfd;
+  u.bsz=cfg->inbuf;
+  u.stail=&u.starved;
+  u.tfd=-1;
+  conn_pool_init(&u.pool,cfg->inbuf);
+  wheel_init(&u.wheel,cfg->timeout);
+  u.m=metrics_worker(w->id);
+  u.m->tid=gettid();
+  u.log=log_worker(w->id);
+  u.reader=w->reader;
+  u.pager=pager_worker(w->id);
+
+  struct io_uring_params p={0,};
+  unsigned entries=cfg->backlog>0 ? cfg->backlog : 1024;
+  p.flags=IORING_SETUP_SINGLE_ISSUER|IORING_SETUP_DEFER_TASKRUN|IORING_SETUP_SUBMIT_ALL|IORING_SETUP_CQSIZE;
+  p.cq_entries=entries*4;
+  int r=io_uring_queue_init_params(entries,&u.ring,&p);
+  if(r==-EINVAL)
+  {
+// older kernel without single issuer and deferred task work
+    memset(&p,0,sizeof(p));
+    p.flags=IORING_SETUP_CQSIZE;
+    p.cq_entries=entries*4;
+    r=io_uring_queue_init_params(entries,&u.ring,&p);
+  }
+  if(r<0) { errno=-r; $abort("io_uring setup"); }
+  if((r=io_uring_register_files_sparse(&u.ring,URING_FILES))<0) { errno=-r; $abort("io_uring file table"); }
+  io_uring_register_ring_fd(&u.ring);
+
+  u.br=io_uring_setup_buf_ring(&u.ring,URING_BUFS,URING_BGID,0,&r);
+  if(!u.br) { errno=-r; $abort("io_uring buffer ring"); }
+  u.bufs=md_malloc(URING_BUFS*u.bsz);
+  for(size_t i=0;i<URING_BUFS;i++) io_uring_buf_ring_add(u.br,u.bufs+i*u.bsz,u.bsz,i,io_uring_buf_ring_mask(URING_BUFS),i);
+  io_uring_buf_ring_advance(u.br,URING_BUFS);
+
+  arm_accept(&u);
+  arm_signal(&u);
+  arm_wake(&u);
+  if(cfg->timeout)
+  {
+    u.tfd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC);
+    if(u.tfd<0) $abort("timerfd");
+    struct timespec t={(1<<u.wheel.shift)/1000,(1<<u.wheel.shift)%1000*1000000};
+    struct itimerspec it={t,t};
+    timerfd_settime(u.tfd,0,&it,0);
+    arm_timer(&u);
+  }
+
+  struct io_uring_cqe** cqes=md_pcalloc(p.cq_entries);
+  conn_t** pend=md_pcalloc(p.cq_entries);
+  const char** keys=md_pcalloc(p.cq_entries);
+  size_t* lens=md_tcalloc(size_t,p.cq_entries);
+  db_value_t* vals=md_tcalloc(db_value_t,p.cq_entries);
+
+  while(!(atomic_load(&ctrl_flags)&CTRL_FLAG_SHUTDOWN))
+  {
+    r=io_uring_submit_and_wait(&u.ring,1);
+    if(r<0 && r!=-EINTR)
+    {
+      errno=-r;
+      perror("io_uring_submit_and_wait");
+      break;
+    }
+
+// completions posted by submissions below are left to next round, pending connections stay valid
+    unsigned n=io_uring_peek_batch_cqe(&u.ring,cqes,p.cq_entries);
+    size_t np=0;
+    int tick=0;
+    wheel_now(&u.wheel);
+    reader_enter(u.reader);
+    for(unsigned i=0;i<n;i++)
+    {
+      const struct io_uring_cqe* e=cqes[i];
+      uint64_t d=io_uring_cqe_get_data64(e);
+      conn_t* c=(conn_t*)(uintptr_t)(d&~OP_MASK);
+      switch(d&OP_MASK)
+      {
+        case OP_ACCEPT:
+          on_accept(&u,e);
+          continue;
+        case OP_SIGNAL:
+          $msg("got signal");
+          server_signal(sfd);
+          if(!(e->flags&IORING_CQE_F_MORE)) arm_signal(&u);
+          continue;
+        case OP_CANCEL:
+          continue;
+        case OP_DRAIN:
+          uring_sweep(&u);
+          continue;
+        case OP_TIMER:
+        {
+          uint64_t x;
+          while(read(u.tfd,&x,sizeof(x))>0);
+          if(!(e->flags&IORING_CQE_F_MORE)) arm_timer(&u);
+          tick=1;
+          continue;
+        }
+// new database generation, shutdown or paged in values
+        case OP_WAKE:
+        {
+          uint64_t x;
+          read(u.reader->efd,&x,sizeof(x));
+          if(!(e->flags&IORING_CQE_F_MORE)) arm_wake(&u);
+          if(u.pager) uring_paged(&u);
+          continue;
+        }
+      }
+      if(!(e->flags&IORING_CQE_F_MORE)) c->pending--;
+      switch(d&OP_MASK)
+      {
+        case OP_RECV:
+          on_recv(&u,c,e,pend,&np);
+          break;
+        case OP_SEND:
+          on_send(&u,c,e,pend,&np);
+          break;
+      }
+      if(c->state==STATE_CLOSE && !c->pending) conn_free(&u,c);
+    }
+    io_uring_cq_advance(&u.ring,n);
+    if(u.recycled) uring_unstarve(&u);
+
+    if(np)
+    {
+      conn_lookup(u.reader,pend,np,keys,lens,vals);
+      for(size_t i=0;i<np;i++)
+      {
+        conn_t* c=pend[i];
+        if(c->state!=STATE_LOOKUP) continue;
+// connection is not freed and not evicted while value is paged in
+        if(conn_page(u.pager,u.reader,c,vals+i))
+        {
+          c->pending++;
+          wheel_cancel(&u.wheel,c);
+          metrics_add(&u.m->paged,1);
+          continue;
+        }
+        metrics_response(u.m,conn_respond(cfg,c,vals+i));
+        reader_hold(u.reader,c);
+        conn_send(&u,c);
+      }
+    }
+    if(tick) wheel_expire(&u.wheel,conn_expire,&u);
+    uint64_t g=reader_cut(u.reader);
+    if(g) uring_cut(&u,g);
+    reader_leave(u.reader);
+    if(!u.draining && (atomic_load(&ctrl_flags)&CTRL_FLAG_DRAIN)) uring_drain(&u);
+    if(u.draining && !u.pool.live) break;
+  }
+
+  if(u.tfd>=0) close(u.tfd);
+  io_uring_free_buf_ring(&u.ring,u.br,URING_BUFS,URING_BGID);
+  io_uring_queue_exit(&u.ring);
+  conn_pool_free(&u.pool);
+  md_free(u.bufs);
+  md_free(cqes);
+  md_free(pend);
+  md_free(keys);
+  md_free(lens);
+  md_free(vals);
+  return 0;
+}
+
+#endif